@@ -0,0 +1,148 @@
+#ifndef MOPE_BENCH_H
+#define MOPE_BENCH_H
+
+/*
+    Shared bits for the headless benchmarks. Each benchmark is a single source
+    file that defines MOPE_ILLUSTRATOR_IMPL itself, then includes this.
+
+    Run with no arguments for the full sizes; with --check, a benchmark runs
+    small sizes only and exits nonzero if any of its results came out wrong.
+    Either way the results go to stdout as one JSON object.
+*/
+
+#include "mope_illustrator.hxx"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mope::bench
+{
+    inline bool Quick(int argc, char** argv)
+    {
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--check") == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Milliseconds `fn` takes, best of `repeats` runs
+    template <class Fn>
+    double Time(Fn&& fn, int repeats = 3)
+    {
+        double best = std::numeric_limits<double>::max();
+        for (int i = 0; i < repeats; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+
+    // Rows of named values, written out as {"benchmark": ..., "results": [...]}
+    class Report
+    {
+    public:
+        explicit Report(std::string name)
+            : m_name{ std::move(name) }
+        { }
+
+        Report& Row()
+        {
+            m_rows.emplace_back();
+            return *this;
+        }
+
+        Report& Add(std::string_view key, double value)
+        {
+            std::ostringstream text;
+            text << value;
+            m_rows.back().emplace_back(key, text.str());
+            return *this;
+        }
+
+        Report& Add(std::string_view key, size_t value)
+        {
+            m_rows.back().emplace_back(key, std::to_string(value));
+            return *this;
+        }
+
+        Report& Add(std::string_view key, std::string_view value)
+        {
+            m_rows.back().emplace_back(key, '"' + std::string{ value } + '"');
+            return *this;
+        }
+
+        Report& Add(std::string_view key, const char* value)
+        {
+            return Add(key, std::string_view{ value });
+        }
+
+        // Record a correctness check; any failure makes Finish() return 1
+        void Expect(bool ok, std::string_view what)
+        {
+            if (!ok) {
+                std::cerr << m_name << ": " << what << " failed\n";
+                ++m_failures;
+            }
+        }
+
+        int Finish(std::ostream& out = std::cout) const
+        {
+            out << "{\"benchmark\":\"" << m_name << "\",\"failures\":" << m_failures << ",\"results\":[";
+            for (size_t i = 0; i < m_rows.size(); ++i) {
+                out << (i ? ",\n" : "\n") << '{';
+                for (size_t j = 0; j < m_rows[i].size(); ++j) {
+                    out << (j ? "," : "") << '"' << m_rows[i][j].first << "\":" << m_rows[i][j].second;
+                }
+                out << '}';
+            }
+            out << "]}\n";
+            return m_failures ? 1 : 0;
+        }
+
+    private:
+        std::string m_name;
+        std::vector<std::vector<std::pair<std::string, std::string>>> m_rows{ };
+        size_t m_failures{ 0 };
+    };
+
+    // Small deterministic generator, so every run sees the same scene
+    class Random
+    {
+    public:
+        explicit Random(uint32_t seed = 1)
+            : m_state{ seed ? seed : 1 }
+        { }
+
+        uint32_t Next()
+        {
+            m_state ^= m_state << 13;
+            m_state ^= m_state >> 17;
+            m_state ^= m_state << 5;
+            return m_state;
+        }
+
+        // Uniform in [low, high)
+        float Uniform(float low, float high)
+        {
+            return low + (high - low) * static_cast<float>(Next() >> 8) / static_cast<float>(1 << 24);
+        }
+
+    private:
+        uint32_t m_state;
+    };
+}
+
+#endif // MOPE_BENCH_H
@@ -0,0 +1,231 @@
+/*
+    PixelCanvas drawing and uploading. Each primitive runs over a canvas with
+    the same random shapes every time and is reported in megapixels written
+    per second; outlines count the pixels along them. Uploads send either the
+    whole canvas or a scattering of small dirty rectangles, through the mapped
+    unpack ring and through its glTexSubImage2D fallback.
+
+    The checks blit regions of a canvas onto itself, overlapping in every
+    direction, and compare against the same blit from a separate copy.
+*/
+
+#define MOPE_ILLUSTRATOR_IMPL
+#include "bench.hxx"
+
+using namespace mope;
+
+namespace
+{
+    Pixel randomPixel(bench::Random& random)
+    {
+        uint32_t bits = random.Next();
+        return { uint8_t(bits), uint8_t(bits >> 8), uint8_t(bits >> 16), uint8_t(bits >> 24) };
+    }
+
+    void scribble(PixelCanvas& canvas, uint32_t seed)
+    {
+        bench::Random random{ seed };
+        Pixel* pixels = canvas.Data();
+        for (size_t i = 0; i < static_cast<size_t>(canvas.Width()) * canvas.Height(); ++i) {
+            pixels[i] = randomPixel(random);
+        }
+    }
+
+    bool samePixels(const PixelCanvas& a, const PixelCanvas& b)
+    {
+        size_t bytes = static_cast<size_t>(a.Width()) * a.Height() * sizeof(Pixel);
+        return std::memcmp(a.Data(), b.Data(), bytes) == 0;
+    }
+
+    void checkSelfBlits(bench::Report& report)
+    {
+        const int offsets[][2] = { { 0, 5 }, { 0, -5 }, { 5, 0 }, { -5, 0 }, { 3, -7 }, { -6, 4 } };
+        for (const auto& offset : offsets) {
+            for (int scale : { 1, 2 }) {
+                for (bool blend : { false, true }) {
+                    PixelCanvas canvas{ 96, 96 };
+                    PixelCanvas expected{ 96, 96 };
+                    scribble(canvas, 9);
+                    scribble(expected, 9);
+
+                    const int x = 20 + offset[0];
+                    const int y = 20 + offset[1];
+                    PixelCanvas::Source region = canvas.Region(20, 20, 30, 25);
+
+                    std::vector<Pixel> copy;
+                    for (int j = 0; j < region.height; ++j) {
+                        const Pixel* row = region.pixels + static_cast<size_t>(j) * region.stride;
+                        copy.insert(copy.end(), row, row + region.width);
+                    }
+                    PixelCanvas::Source separate{ copy.data(), region.width, region.height, region.width };
+
+                    if (blend) {
+                        canvas.BlendBlit(x, y, region, scale);
+                        expected.BlendBlit(x, y, separate, scale);
+                    }
+                    else {
+                        canvas.Blit(x, y, region, scale);
+                        expected.Blit(x, y, separate, scale);
+                    }
+
+                    std::string what = std::string{ blend ? "blend blit" : "blit" }
+                        + " onto itself by (" + std::to_string(offset[0]) + ", " + std::to_string(offset[1])
+                        + ") at scale " + std::to_string(scale);
+                    report.Expect(samePixels(canvas, expected), what);
+                }
+            }
+        }
+    }
+
+    // Time `draw` over `count` shapes, given how many pixels each one writes
+    template <class Draw>
+    void primitive(bench::Report& report, const char* name, size_t count, Draw&& draw)
+    {
+        size_t pixels = 0;
+        double milliseconds = bench::Time([&] {
+            bench::Random random{ 13 };
+            pixels = 0;
+            for (size_t i = 0; i < count; ++i) {
+                pixels += draw(random);
+            }
+        });
+
+        report.Row()
+            .Add("primitive", name)
+            .Add("count", count)
+            .Add("megapixels", pixels / 1e6)
+            .Add("megapixelsPerSecond", pixels / milliseconds / 1000.0);
+    }
+
+    void primitives(bench::Report& report, int size, bool quick)
+    {
+        PixelCanvas canvas{ size, size };
+        const float side = static_cast<float>(size);
+        const size_t count = quick ? 200 : 5000;
+
+        bench::Random spriteRandom{ 17 };
+        std::vector<Pixel> sprite(64 * 64);
+        for (Pixel& pixel : sprite) {
+            pixel = randomPixel(spriteRandom);
+        }
+        const PixelCanvas::Source source{ sprite.data(), 64, 64, 64 };
+
+        auto at = [&](bench::Random& random) { return static_cast<int>(random.Uniform(0.f, side)); };
+        // pixels inside the canvas of a rectangle with its corner at (x, y)
+        auto clipped = [&](int x, int y, int width, int height) {
+            return static_cast<size_t>(std::min(width, size - x)) * std::min(height, size - y);
+        };
+
+        primitive(report, "clear", quick ? 10 : 100, [&](bench::Random& random) {
+            canvas.Clear(randomPixel(random));
+            return static_cast<size_t>(size) * size;
+        });
+        primitive(report, "fillRect", count, [&](bench::Random& random) {
+            int x = at(random), y = at(random);
+            int width = 1 + static_cast<int>(random.Uniform(0.f, 128.f));
+            int height = 1 + static_cast<int>(random.Uniform(0.f, 128.f));
+            canvas.FillRect(x, y, width, height, randomPixel(random));
+            return clipped(x, y, width, height);
+        });
+        primitive(report, "drawLine", count, [&](bench::Random& random) {
+            int x0 = at(random), y0 = at(random), x1 = at(random), y1 = at(random);
+            canvas.DrawLine(x0, y0, x1, y1, randomPixel(random));
+            return static_cast<size_t>(std::max(std::abs(x1 - x0), std::abs(y1 - y0)) + 1);
+        });
+        primitive(report, "drawCircle", count, [&](bench::Random& random) {
+            int x = at(random), y = at(random);
+            float radius = random.Uniform(1.f, 64.f);
+            canvas.DrawCircle(x, y, static_cast<int>(radius), randomPixel(random));
+            return static_cast<size_t>(fTau * radius);
+        });
+        primitive(report, "fillCircle", count, [&](bench::Random& random) {
+            int x = at(random), y = at(random);
+            float radius = random.Uniform(1.f, 64.f);
+            canvas.FillCircle(x, y, static_cast<int>(radius), randomPixel(random));
+            return static_cast<size_t>(fPi * radius * radius);
+        });
+        primitive(report, "blit", count, [&](bench::Random& random) {
+            int x = at(random), y = at(random);
+            canvas.Blit(x, y, source);
+            return clipped(x, y, 64, 64);
+        });
+        primitive(report, "blitScaled", count, [&](bench::Random& random) {
+            int x = at(random), y = at(random);
+            canvas.Blit(x, y, source, 3);
+            return clipped(x, y, 192, 192);
+        });
+        primitive(report, "blendBlit", count, [&](bench::Random& random) {
+            int x = at(random), y = at(random);
+            canvas.BlendBlit(x, y, source);
+            return clipped(x, y, 64, 64);
+        });
+        primitive(report, "selfBlit", count, [&](bench::Random& random) {
+            // up and to the right, over itself
+            int x = at(random), y = at(random);
+            PixelCanvas::Source region = canvas.Region(x, y, 64, 64);
+            canvas.Blit(x + 8, y + 8, region);
+            return x + 8 < size && y + 8 < size ? clipped(x + 8, y + 8, region.width, region.height) : 0;
+        });
+    }
+
+    void uploads(bench::Report& report, int size, bool quick)
+    {
+        const size_t frames = quick ? 10 : 200;
+        const int rects = 12;
+        const int rectSide = 32;
+
+        for (bool mapped : { true, false }) {
+            headless::SetPersistentMapping(mapped);
+            gl::BindProcs();
+
+            for (bool whole : { true, false }) {
+                PixelCanvas canvas{ size, size };
+                canvas.Upload();
+                headless::Recorder().Reset();
+
+                // far enough apart that the dirty rectangles stay separate
+                size_t pixels = 0;
+                double milliseconds = bench::Time([&] {
+                    for (size_t frame = 0; frame < frames; ++frame) {
+                        Pixel color{ uint8_t(frame), 0, 0, 255 };
+                        if (whole) {
+                            canvas.Clear(color);
+                        }
+                        else {
+                            for (int i = 0; i < rects; ++i) {
+                                canvas.FillRect(i * 2 * rectSide % size, i * 2 * rectSide / size * 2 * rectSide, rectSide, rectSide, color);
+                            }
+                        }
+                        canvas.Upload();
+                    }
+                }, 1);
+                pixels = frames * (whole ? static_cast<size_t>(size) * size : size_t{ rects } * rectSide * rectSide);
+
+                const size_t bytes = headless::Recorder().textureBytes;
+                report.Row()
+                    .Add("upload", mapped ? "mapped" : "fallback")
+                    .Add("dirty", whole ? "whole" : "rects")
+                    .Add("frames", frames)
+                    .Add("megapixelsPerSecond", pixels / milliseconds / 1000.0)
+                    .Add("textureBytes", bytes);
+
+                std::string what = std::string{ mapped ? "mapped" : "fallback" } + (whole ? " whole" : " rects");
+                report.Expect(bytes == pixels * sizeof(Pixel), what + " uploads only the dirty pixels");
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench::Quick(argc, argv);
+    bench::Report report{ "canvas" };
+
+    checkSelfBlits(report);
+
+    const int size = quick ? 256 : 1024;
+    primitives(report, size, quick);
+    uploads(report, size, quick);
+
+    return report.Finish();
+}
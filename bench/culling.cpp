@@ -0,0 +1,108 @@
+/*
+    Frustum culling through the spatial grid against testing every instance.
+    Sprites are scattered over a world that grows with their count, so a
+    screen-sized camera sees about the same number whatever the total. Each
+    row gives the drawn and culled counts of one InstancedSprite draw, and the
+    cost of finding the visible set both ways. The checks also submit each
+    view through a RenderQueue, which should get the same instances.
+*/
+
+#define MOPE_ILLUSTRATOR_IMPL
+#include "bench.hxx"
+
+using namespace mope;
+
+namespace
+{
+    constexpr float screenWidth = 640.f;
+    constexpr float screenHeight = 480.f;
+
+    struct View
+    {
+        const char* name;
+        mat4f viewProjection;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench::Quick(argc, argv);
+    bench::Report report{ "culling" };
+
+    headless::SetPersistentMapping(false);
+    gl::BindProcs();
+
+    std::vector<size_t> counts = quick
+        ? std::vector<size_t>{ 10000 }
+        : std::vector<size_t>{ 10000, 100000, 1000000 };
+
+    for (size_t count : counts) {
+        // about 400 sprites per screenful
+        const float side = screenWidth * std::sqrt(count / 400.f);
+
+        Shader shader;
+        InstancedSprite sprite{ shader, Texture2D{ } };
+        RenderQueue queue;
+        bench::Random random{ 5 };
+        for (size_t i = 0; i < count; ++i) {
+            sprite.MakeInstance(
+                { random.Uniform(0.f, side), random.Uniform(0.f, side), -1.f },
+                { random.Uniform(4.f, 48.f), random.Uniform(4.f, 48.f), 1.f },
+                random.Uniform(0.f, fTau));
+        }
+
+        const mat4f screen = gl::ortho(0.f, screenWidth, 0.f, screenHeight, -10.f, 10.f);
+        const View views[] = {
+            { "screen", screen * gl::translation({ -side / 2.f, -side / 2.f, 0.f }) },
+            { "perspective", gl::perspective(1.f, screenWidth / screenHeight, 1.f, 2000.f)
+                * gl::translation({ -side / 2.f, -side / 2.f, -900.f }) },
+            { "everything", gl::ortho(0.f, side, 0.f, side, -10.f, 10.f) },
+        };
+
+        for (const View& view : views) {
+            sprite.SetViewProjection(view.viewProjection);
+            headless::Recorder().Reset();
+            sprite.Render();
+            const InstancedSprite::CullStats stats = sprite.LastFrame();
+            const size_t instances = headless::Recorder().instances;
+
+            // everything the grid walks past, tested one by one
+            const Frustum frustum{ view.viewProjection };
+            const mat4f* models = sprite.Instances().Models();
+            size_t bruteDrawn = 0;
+            double bruteMs = bench::Time([&] {
+                bruteDrawn = 0;
+                for (size_t i = 0; i < count; ++i) {
+                    bruteDrawn += frustum.Intersects(Bounds::OfQuad(models[i]));
+                }
+            });
+
+            // with nothing moved, a draw is the grid query plus uploading the
+            // visible indices
+            double gridMs = bench::Time([&] {
+                sprite.Render();
+            });
+
+            report.Row()
+                .Add("instances", count)
+                .Add("view", view.name)
+                .Add("drawn", stats.drawn)
+                .Add("culled", stats.culled)
+                .Add("gridMs", gridMs)
+                .Add("bruteForceMs", bruteMs)
+                .Add("speedup", bruteMs / gridMs);
+
+            std::string what = std::to_string(count) + " " + view.name;
+            report.Expect(stats.drawn == bruteDrawn, what + " drawn matches brute force");
+            report.Expect(stats.drawn + stats.culled == count, what + " drawn plus culled");
+            report.Expect(instances == stats.drawn, what + " instances reaching the driver");
+
+            sprite.Submit(queue);
+            queue.Flush();
+            report.Expect(sprite.LastFrame().drawn == stats.drawn, what + " submitted drawn count");
+            report.Expect(queue.LastFrame().items == stats.drawn, what + " submitted instances");
+        }
+    }
+
+    return report.Finish();
+}
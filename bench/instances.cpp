@@ -0,0 +1,154 @@
+/*
+    Instance upload throughput: the SSBO ring (persistently mapped, and its
+    glBufferSubData fallback) against re-uploading the whole matrix buffer
+    every frame. Each frame moves some fraction of the instances, rebuilds
+    their matrices and uploads; reported as instances per millisecond.
+
+    The checks also make sure a mapped ring going away leaves other storage
+    buffers' uploads reaching their buffers.
+*/
+
+#define MOPE_ILLUSTRATOR_IMPL
+#include "bench.hxx"
+
+using namespace mope;
+
+namespace
+{
+    enum class Path { WholeBuffer, Ring, RingFallback };
+
+    const char* name(Path path)
+    {
+        switch (path) {
+        case Path::WholeBuffer: return "whole-buffer";
+        case Path::Ring: return "ring";
+        default: return "ring-fallback";
+        }
+    }
+
+    struct Result
+    {
+        double milliseconds;
+        size_t bytes;
+    };
+
+    Result run(Path path, size_t count, size_t moved, size_t frames)
+    {
+        // the ring decides between mapping and fallback when it first grows
+        headless::SetPersistentMapping(path != Path::RingFallback);
+        gl::BindProcs();
+
+        InstanceStore store;
+        std::vector<InstanceStore::Handle> handles;
+        bench::Random random{ 7 };
+        for (size_t i = 0; i < count; ++i) {
+            handles.push_back(store.Add({
+                { random.Uniform(0.f, 1000.f), random.Uniform(0.f, 1000.f), -1.f },
+                { 8.f, 8.f, 1.f },
+                random.Uniform(0.f, fTau)
+            }));
+        }
+        store.Update();
+
+        SSBO whole{ 0 };
+        SSBORing ring{ 0 };
+        std::vector<IndexRange> everything{ { 0, count } };
+        size_t next = 0;
+
+        headless::Recorder().Reset();
+        double milliseconds = bench::Time([&] {
+            for (size_t frame = 0; frame < frames; ++frame) {
+                for (size_t i = 0; i < moved; ++i) {
+                    store.Move(handles[next], { 1.f, 0.5f, 0.f });
+                    next = (next + 1) % count;
+                }
+                const std::vector<IndexRange>& changed = store.Update();
+
+                if (path == Path::WholeBuffer) {
+                    whole.Fill(store.Models(), count * sizeof(mat4f));
+                }
+                else {
+                    // the first upload sends everything anyway
+                    ring.Upload(store.Models(), count, sizeof(mat4f), frame ? changed : everything);
+                    ring.Fence();
+                }
+            }
+        }, 1);
+
+        return { milliseconds, headless::Recorder().bufferBytes };
+    }
+
+    void checkRingRelease(bench::Report& report)
+    {
+        headless::SetPersistentMapping(true);
+        gl::BindProcs();
+        gl::ResetBindCache();
+
+        Shader shader;
+        Texture2D texture;
+        BasicSprite sprite{ Instance::Data{ { 0.f, 0.f, -1.f }, { 8.f, 8.f, 1.f }, 0.f }, shader, texture };
+        {
+            InstancedSprite field{ shader, texture };
+            field.MakeInstance({ 0.f, 0.f, -1.f }, { 8.f, 8.f, 1.f });
+            field.Render();
+            // leaves the sprite's buffer the one bound, as far as the cache knows
+            sprite.Render();
+        }
+
+        headless::Recorder().Reset();
+        sprite.Move({ 1.f, 0.f, 0.f });
+        sprite.Render();
+        report.Expect(headless::Recorder().unboundWrites == 0, "sprite uploads reach its buffer after a ring is deleted");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench::Quick(argc, argv);
+    bench::Report report{ "instances" };
+
+    checkRingRelease(report);
+
+    std::vector<size_t> counts = quick
+        ? std::vector<size_t>{ 1000, 10000 }
+        : std::vector<size_t>{ 1000, 10000, 100000, 1000000 };
+
+    for (size_t count : counts) {
+        size_t frames = std::clamp<size_t>(2000000 / count, 8, 200);
+
+        for (double fraction : { 1.0, 0.01 }) {
+            size_t moved = std::max<size_t>(1, static_cast<size_t>(count * fraction));
+            size_t wholeBytes = 0;
+
+            for (Path path : { Path::WholeBuffer, Path::Ring, Path::RingFallback }) {
+                Result result = run(path, count, moved, frames);
+
+                report.Row()
+                    .Add("path", name(path))
+                    .Add("instances", count)
+                    .Add("moved", moved)
+                    .Add("frames", frames)
+                    .Add("instancesPerMs", count * frames / result.milliseconds);
+
+                // mapped writes never reach the driver, so there's nothing to count
+                if (path == Path::Ring) {
+                    continue;
+                }
+                report.Add("bytesUploaded", result.bytes);
+
+                if (path == Path::WholeBuffer) {
+                    wholeBytes = result.bytes;
+                    report.Expect(result.bytes == frames * count * sizeof(mat4f), "whole buffer uploads every matrix");
+                }
+                else if (moved == count) {
+                    report.Expect(result.bytes == wholeBytes, "fallback uploads every matrix when all move");
+                }
+                else {
+                    report.Expect(result.bytes < wholeBytes / 2, "fallback only uploads what moved");
+                }
+            }
+        }
+    }
+
+    return report.Finish();
+}
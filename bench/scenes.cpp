@@ -0,0 +1,266 @@
+/*
+    Whole frames through the core loop on the headless backend. Each scene is
+    deterministic: it steps a fixed 1/60 s per frame whatever the clock says,
+    so the driver counters come out the same on every run and only the timings
+    vary.
+
+    sprites     N BasicSprites over a few textures, through frameQueue()
+    layers      the same, spread over several depth layers instead of one
+    particles   one InstancedSprite holding a particle field, a tenth of it
+                moving each frame
+    animation   an Animator driving a crowd of instances, plus a handful of
+                AnimatedSprites through the queue
+*/
+
+#define MOPE_ILLUSTRATOR_IMPL
+#include "bench.hxx"
+
+using namespace mope;
+
+namespace
+{
+    constexpr int width = 640;
+    constexpr int height = 480;
+    constexpr double step = 1.0 / 60.0;
+
+    Texture2D solidTexture(Pixel color)
+    {
+        std::vector<Pixel> pixels(16 * 16, color);
+        Texture2D texture;
+        texture.Make(16, 16, pixels.data());
+        return texture;
+    }
+
+    class Scene : public Illustrator<uint8_t>
+    {
+    public:
+        Scene(size_t frames)
+            : Illustrator{ std::make_unique<headless::Window>(width, height, frames), "scene" }
+        { }
+
+    protected:
+        bool gameStart() override
+        {
+            setProjection(gl::ortho(0.f, width, 0.f, height, -10.f, 10.f));
+            start();
+            return true;
+        }
+
+        bool gameUpdate(double) override
+        {
+            update(m_frame++);
+            return true;
+        }
+
+        virtual void start() = 0;
+        virtual void update(size_t frame) = 0;
+
+        bench::Random m_random{ 11 };
+
+    private:
+        size_t m_frame{ 0 };
+    };
+
+    class Sprites : public Scene
+    {
+    public:
+        // depths are drawn from [nearest, farthest)
+        Sprites(size_t frames, size_t count, float nearest, float farthest)
+            : Scene{ frames }
+            , m_count{ count }
+            , m_nearest{ nearest }
+            , m_farthest{ farthest }
+        { }
+
+    private:
+        void start() override
+        {
+            for (uint8_t i = 0; i < 4; ++i) {
+                m_textures.push_back(solidTexture({ uint8_t(60 * i), 128, 255, 255 }));
+            }
+            for (size_t i = 0; i < m_count; ++i) {
+                vec3f position{ m_random.Uniform(0.f, width), m_random.Uniform(0.f, height), m_random.Uniform(m_nearest, m_farthest) };
+                m_sprites.push_back(std::make_unique<BasicSprite>(
+                    Instance::Data{ position, { 16.f, 16.f, 1.f }, 0.f },
+                    defaultShader,
+                    m_textures[i % m_textures.size()]
+                ));
+            }
+        }
+
+        void update(size_t frame) override
+        {
+            for (size_t i = 0; i < m_sprites.size(); ++i) {
+                float phase = static_cast<float>(frame * step + i);
+                m_sprites[i]->Move({ std::cos(phase), std::sin(phase), 0.f });
+                m_sprites[i]->Rotate(static_cast<float>(step));
+                m_sprites[i]->Submit(frameQueue());
+            }
+        }
+
+        size_t m_count;
+        float m_nearest;
+        float m_farthest;
+        std::vector<Texture2D> m_textures{ };
+        std::vector<std::unique_ptr<BasicSprite>> m_sprites{ };
+    };
+
+    class Particles : public Scene
+    {
+    public:
+        Particles(size_t frames, size_t count)
+            : Scene{ frames }
+            , m_count{ count }
+        { }
+
+    private:
+        struct Particle
+        {
+            InstanceStore::Handle handle;
+            vec3f velocity;
+        };
+
+        void start() override
+        {
+            m_field = std::make_unique<InstancedSprite>(defaultShader, solidTexture({ 255, 200, 80, 255 }));
+            for (size_t i = 0; i < m_count; ++i) {
+                vec3f position{ m_random.Uniform(0.f, width), m_random.Uniform(0.f, height), -1.f };
+                vec3f velocity{ m_random.Uniform(-60.f, 60.f), m_random.Uniform(-60.f, 60.f), 0.f };
+                m_particles.push_back({ m_field->MakeInstance(position, { 2.f, 2.f, 1.f }), velocity });
+            }
+        }
+
+        void update(size_t frame) override
+        {
+            // a different tenth of the field moves each frame
+            InstanceStore& instances = m_field->Instances();
+            for (size_t i = frame % 10; i < m_particles.size(); i += 10) {
+                instances.Move(m_particles[i].handle, m_particles[i].velocity * static_cast<float>(10 * step));
+            }
+            m_field->Render();
+        }
+
+        size_t m_count;
+        std::unique_ptr<InstancedSprite> m_field{ };
+        std::vector<Particle> m_particles{ };
+    };
+
+    class Animation : public Scene
+    {
+    public:
+        Animation(size_t frames, size_t crowd, size_t sprites)
+            : Scene{ frames }
+            , m_crowdSize{ crowd }
+            , m_spriteCount{ sprites }
+        { }
+
+    private:
+        void start() override
+        {
+            Texture2D sheet = solidTexture({ 90, 220, 120, 255 });
+
+            // an eight-frame walk cycle along one row of a sheet
+            auto walk = std::make_shared<AnimationClip>();
+            for (int i = 0; i < 8; ++i) {
+                walk->frames.push_back({ { i / 8.f, 0.f }, { (i + 1) / 8.f, 0.25f }, 0.1 });
+            }
+            auto wave = std::make_shared<AnimationClip>(*walk);
+            wave->mode = AnimationClip::Mode::PingPong;
+
+            m_crowd = std::make_unique<InstancedSprite>(defaultShader, sheet);
+            for (size_t i = 0; i < m_crowdSize; ++i) {
+                vec3f position{ m_random.Uniform(0.f, width), m_random.Uniform(0.f, height), -1.f };
+                InstanceStore::Handle handle = m_crowd->MakeInstance(position, { 12.f, 12.f, 1.f });
+                // stagger the start times and speeds so frames change every update
+                m_animator.Play(handle, i % 2 ? walk : wave, m_random.Uniform(0.5f, 2.f), m_random.Uniform(0.f, 1.f));
+            }
+
+            for (size_t i = 0; i < m_spriteCount; ++i) {
+                Instance::Data data{ { m_random.Uniform(0.f, width), m_random.Uniform(0.f, height), -2.f }, { 24.f, 24.f, 1.f }, 0.f };
+                auto sprite = std::make_unique<AnimatedSprite>(data, defaultShader);
+                for (const AnimationClip::Frame& frame : walk->frames) {
+                    sprite->AddFrame({ sheet, frame.leftBottom, frame.rightTop, frame.duration });
+                }
+                sprite->SwitchTo(i % walk->frames.size());
+                m_sprites.push_back(std::move(sprite));
+            }
+        }
+
+        void update(size_t) override
+        {
+            m_animator.Update(step, m_crowd->Instances());
+            m_crowd->Render();
+
+            for (auto& sprite : m_sprites) {
+                sprite->Advance(step);
+                sprite->Submit(frameQueue());
+            }
+        }
+
+        size_t m_crowdSize;
+        size_t m_spriteCount;
+        Animator m_animator{ };
+        std::unique_ptr<InstancedSprite> m_crowd{ };
+        std::vector<std::unique_ptr<AnimatedSprite>> m_sprites{ };
+    };
+
+    void run(bench::Report& report, const char* name, Scene& scene, size_t drawCalls, size_t instances)
+    {
+        headless::Recorder().Reset();
+        scene.run();
+
+        const headless::Recording& recording = headless::Recorder();
+        report.Row()
+            .Add("scene", name)
+            .Add("frames", recording.frames)
+            .Add("msPerFrame", recording.frames ? recording.frameSeconds * 1000.0 / recording.frames : 0.0)
+            .Add("drawCalls", recording.drawCalls)
+            .Add("instances", recording.instances)
+            .Add("bufferBytes", recording.bufferBytes)
+            .Add("textureBytes", recording.textureBytes)
+            .Add("programBinds", recording.programBinds)
+            .Add("textureBinds", recording.textureBinds)
+            .Add("bufferBinds", recording.bufferBinds);
+
+        report.Expect(recording.drawCalls == drawCalls, std::string{ name } + " draw calls");
+        report.Expect(recording.instances == instances, std::string{ name } + " instances");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench::Quick(argc, argv);
+    bench::Report report{ "scenes" };
+
+    // mapped uploads would go uncounted
+    headless::SetPersistentMapping(false);
+
+    const size_t frames = quick ? 30 : 600;
+
+    {
+        const size_t count = quick ? 200 : 5000;
+        Sprites scene{ frames, count, -1.f, -1.f };
+        // one draw per texture
+        run(report, "sprites", scene, 4 * frames, count * frames);
+    }
+    {
+        const size_t count = quick ? 200 : 5000;
+        Sprites scene{ frames, count, -5.f, 0.f };
+        // one draw per texture in each of the five layers
+        run(report, "layers", scene, 5 * 4 * frames, count * frames);
+    }
+    {
+        const size_t count = quick ? 5000 : 200000;
+        Particles scene{ frames, count };
+        run(report, "particles", scene, frames, count * frames);
+    }
+    {
+        const size_t crowd = quick ? 2000 : 50000;
+        const size_t sprites = quick ? 20 : 200;
+        Animation scene{ frames, crowd, sprites };
+        // the crowd, then the queued sprites sharing its sheet
+        run(report, "animation", scene, 2 * frames, (crowd + sprites) * frames);
+    }
+
+    return report.Finish();
+}
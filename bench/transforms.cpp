@@ -0,0 +1,146 @@
+/*
+    BuildModels() at every SIMD level the CPU supports: checks each against
+    mope_vec's translate * rotate * scale and against the scalar path (which
+    must match bit for bit), then reports matrices per second. Per-level rows
+    run on one thread; the "pooled" row is BuildModels() as the sprites call it.
+*/
+
+#define MOPE_ILLUSTRATOR_IMPL
+#include "bench.hxx"
+
+using namespace mope;
+
+namespace
+{
+    struct Transforms
+    {
+        std::vector<float> px, py, pz, sx, sy, sz, rotation;
+
+        explicit Transforms(size_t count)
+        {
+            bench::Random random{ 3 };
+            for (size_t i = 0; i < count; ++i) {
+                px.push_back(random.Uniform(-1000.f, 1000.f));
+                py.push_back(random.Uniform(-1000.f, 1000.f));
+                pz.push_back(random.Uniform(-10.f, 10.f));
+                sx.push_back(random.Uniform(-64.f, 64.f));
+                sy.push_back(random.Uniform(-64.f, 64.f));
+                sz.push_back(random.Uniform(0.5f, 2.f));
+                // plenty of unrotated sprites, which take a shortcut
+                rotation.push_back(i % 5 ? random.Uniform(-fTau, fTau) : 0.f);
+            }
+        }
+
+        TransformArrays View() const
+        {
+            return { px.data(), py.data(), pz.data(), sx.data(), sy.data(), sz.data(), rotation.data() };
+        }
+    };
+
+    std::vector<simd::Level> supportedLevels()
+    {
+        std::vector<simd::Level> levels{ simd::Level::Scalar };
+        for (simd::Level level : { simd::Level::SSE, simd::Level::AVX2 }) {
+            if (level <= simd::Detect()) {
+                levels.push_back(level);
+            }
+        }
+        return levels;
+    }
+
+    bool nearlyEqual(const mat4f& a, const mat4f& b)
+    {
+        for (size_t c = 0; c < 4; ++c) {
+            for (size_t r = 0; r < 4; ++r) {
+                float tolerance = 1e-6f * std::max(1.f, std::abs(b[c][r]));
+                if (std::abs(a[c][r] - b[c][r]) > tolerance) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void check(bench::Report& report)
+    {
+        const Transforms transforms{ 1003 };
+        const TransformArrays in = transforms.View();
+
+        // odd sizes leave every kind of tail behind the vector loops
+        for (size_t count : { size_t{ 0 }, size_t{ 1 }, size_t{ 7 }, size_t{ 9 }, size_t{ 1003 } }) {
+            std::vector<mat4f> scalar(count);
+            BuildModels(in, count, scalar.data(), simd::Level::Scalar);
+
+            bool matchesVec = true;
+            for (size_t i = 0; i < count; ++i) {
+                mat4f expected = gl::translation({ in.px[i], in.py[i], in.pz[i] })
+                    * gl::rotation(in.rotation[i])
+                    * gl::scale({ in.sx[i], in.sy[i], in.sz[i] });
+                matchesVec = matchesVec && nearlyEqual(scalar[i], expected);
+            }
+            report.Expect(matchesVec, "scalar matches mope_vec at count " + std::to_string(count));
+
+            for (simd::Level level : supportedLevels()) {
+                std::vector<mat4f> simd(count);
+                BuildModels(in, count, simd.data(), level);
+                bool identical = std::memcmp(simd.data(), scalar.data(), count * sizeof(mat4f)) == 0;
+                report.Expect(identical, std::string{ simd::Name(level) } + " matches scalar at count " + std::to_string(count));
+            }
+        }
+
+        // big enough to go through the thread pool
+        const size_t count = settings::transformParallelThreshold * 2 + 5;
+        const Transforms many{ count };
+        std::vector<mat4f> serial(count), pooled(count);
+        for (size_t begin = 0; begin < count; begin += 1000) {
+            size_t end = std::min(count, begin + 1000);
+            BuildModels(many.View().offset(begin), end - begin, serial.data() + begin, simd::Level::Scalar);
+        }
+        BuildModels(many.View(), count, pooled.data());
+        report.Expect(std::memcmp(serial.data(), pooled.data(), count * sizeof(mat4f)) == 0, "pooled matches serial");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool quick = bench::Quick(argc, argv);
+    bench::Report report{ "transforms" };
+
+    check(report);
+
+    const size_t count = quick ? 100000 : 1000000;
+    const Transforms transforms{ count };
+    const TransformArrays in = transforms.View();
+    std::vector<mat4f> out(count);
+
+    // below the parallel threshold, so BuildModels() stays on this thread
+    const size_t batch = 4096;
+    static_assert(batch < settings::transformParallelThreshold);
+
+    for (simd::Level level : supportedLevels()) {
+        double milliseconds = bench::Time([&] {
+            for (size_t begin = 0; begin < count; begin += batch) {
+                size_t n = std::min(batch, count - begin);
+                BuildModels(in.offset(begin), n, out.data() + begin, level);
+            }
+        }, quick ? 1 : 5);
+
+        report.Row()
+            .Add("level", simd::Name(level))
+            .Add("threads", size_t{ 1 })
+            .Add("matrices", count)
+            .Add("matricesPerSecond", count / milliseconds * 1000.0);
+    }
+
+    double milliseconds = bench::Time([&] {
+        BuildModels(in, count, out.data());
+    }, quick ? 1 : 5);
+
+    report.Row()
+        .Add("level", simd::Name(simd::Active()))
+        .Add("threads", ThreadPool::Shared().Size() + 1)
+        .Add("matrices", count)
+        .Add("matricesPerSecond", count / milliseconds * 1000.0);
+
+    return report.Finish();
+}
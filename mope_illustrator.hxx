@@ -4,30 +4,85 @@
 /*
     To use, #define MOPE_ILLUSTRATOR_IMPL before the #include in exactly one of
     your source files.
+
+    #define MOPE_ILLUSTRATOR_HEADLESS (everywhere) to build without a window or
+    GPU: OpenGL calls go to a recording null driver instead (see
+    mope::headless). This also works on platforms other than Windows.
 */
 
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <deque>
 #include <string>
 #include <string_view>
 #include <vector>
+#include <variant>
 #include <cassert>
 #include <unordered_map>
 #include <set>
 #include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <limits>
 #include <bitset>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
 
 #include "mope_vec/mope_vec.hxx"
 
+#if !defined MOPE_ILLUSTRATOR_HEADLESS
 #include <GL/GL.h>
 #pragma comment(lib, "opengl32.lib")
+#else
+// Without a real OpenGL we have to supply even the 1.1 basics
+typedef unsigned int GLenum;
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
+typedef float GLfloat;
+typedef unsigned char GLboolean;
+typedef unsigned char GLubyte;
+typedef unsigned int GLbitfield;
+
+#define GL_FALSE                            0
+#define GL_TRUE                             1
+#define GL_NO_ERROR                         0
+#define GL_TRIANGLE_STRIP                   0x0005
+#define GL_SRC_ALPHA                        0x0302
+#define GL_ONE_MINUS_SRC_ALPHA              0x0303
+#define GL_BLEND                            0x0BE2
+#define GL_TEXTURE_2D                       0x0DE1
+#define GL_UNSIGNED_BYTE                    0x1401
+#define GL_FLOAT                            0x1406
+#define GL_RED                              0x1903
+#define GL_RGB                              0x1907
+#define GL_RGBA                             0x1908
+#define GL_NEAREST                          0x2600
+#define GL_TEXTURE_MAG_FILTER               0x2800
+#define GL_TEXTURE_MIN_FILTER               0x2801
+#define GL_TEXTURE_WRAP_S                   0x2802
+#define GL_TEXTURE_WRAP_T                   0x2803
+#define GL_UNPACK_ROW_LENGTH                0x0CF2
+#define GL_COLOR_BUFFER_BIT                 0x00004000
+#endif
 
 // We define OpenGL junk and load up extensions (this replaces a more rigorous
 // extension loader--such as GLEW--for my limited purposes)
 typedef intptr_t GLintptr;
 typedef uintptr_t GLsizeiptr;
 typedef char GLchar;
+typedef struct __GLsync* GLsync;
+typedef uint64_t GLuint64;
 
 #define GL_ARRAY_BUFFER						0x8892
 #define GL_ELEMENT_ARRAY_BUFFER				0x8893
@@ -43,6 +98,14 @@ typedef char GLchar;
 #define GL_TEXTURE0							0x84C0
 #define GL_RG							    0x8227
 #define GL_CLAMP_TO_EDGE                    0x812F
+#define GL_MAP_WRITE_BIT                    0x0002
+#define GL_MAP_PERSISTENT_BIT               0x0040
+#define GL_MAP_COHERENT_BIT                 0x0080
+#define GL_SYNC_GPU_COMMANDS_COMPLETE       0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT          0x00000001
+#define GL_ALREADY_SIGNALED                 0x911A
+#define GL_TIMEOUT_EXPIRED                  0x911B
+#define GL_PIXEL_UNPACK_BUFFER              0x88EC
 
 #define GL_PROCS \
     GL_PROC(void,	glGenBuffers,				GLsizei n, GLuint* buffers) \
@@ -108,14 +171,53 @@ typedef char GLchar;
     GL_PROC(void,	glUniformMatrix4x2fv,		GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) \
     GL_PROC(void,	glUniformMatrix3x4fv,		GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) \
     GL_PROC(void,	glUniformMatrix4x3fv,		GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) \
-    GL_PROC(void,   glBindBufferBase,           GLenum target, GLuint index, GLuint buffer)
+    GL_PROC(void,   glBindBufferBase,           GLenum target, GLuint index, GLuint buffer) \
+    GL_PROC(void,   glBindBufferRange,          GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) \
+    GL_PROC(void,   glBufferStorage,            GLenum target, GLsizeiptr size, const void* data, GLbitfield flags) \
+    GL_PROC(void*,  glMapBufferRange,           GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) \
+    GL_PROC(GLboolean, glUnmapBuffer,           GLenum target) \
+    GL_PROC(GLsync, glFenceSync,                GLenum condition, GLbitfield flags) \
+    GL_PROC(GLenum, glClientWaitSync,           GLsync sync, GLbitfield flags, GLuint64 timeout) \
+    GL_PROC(void,   glDeleteSync,               GLsync sync)
+
+#if defined MOPE_ILLUSTRATOR_HEADLESS
+
+// The 1.1 entry points that opengl32 would otherwise export directly
+#define GL_PROCS_CORE \
+    GL_PROC(void,   glClear,                    GLbitfield mask) \
+    GL_PROC(void,   glClearColor,               GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) \
+    GL_PROC(void,   glViewport,                 GLint x, GLint y, GLsizei width, GLsizei height) \
+    GL_PROC(void,   glEnable,                   GLenum cap) \
+    GL_PROC(void,   glBlendFunc,                GLenum sfactor, GLenum dfactor) \
+    GL_PROC(GLenum, glGetError,                 void) \
+    GL_PROC(void,   glDrawElements,             GLenum mode, GLsizei count, GLenum type, const void* indices) \
+    GL_PROC(void,   glGenTextures,              GLsizei n, GLuint* textures) \
+    GL_PROC(void,   glDeleteTextures,           GLsizei n, const GLuint* textures) \
+    GL_PROC(void,   glBindTexture,              GLenum target, GLuint texture) \
+    GL_PROC(void,   glTexImage2D,               GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels) \
+    GL_PROC(void,   glTexSubImage2D,            GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels) \
+    GL_PROC(void,   glTexParameteri,            GLenum target, GLenum pname, GLint param) \
+    GL_PROC(void,   glPixelStorei,              GLenum pname, GLint param)
+
+namespace mope::headless
+{
+    using GenericProc = void(*)();
+    GenericProc GetProcAddress(const char* name);
+}
 
-#if defined _WIN32
+#define getProcAddress mope::headless::GetProcAddress
+#define GL_PROCS_EX GL_PROCS_CORE
+#define GL_PROC(type, name, ...) \
+    typedef type (name##_t)(__VA_ARGS__); \
+    extern name##_t* name;
+
+#elif defined _WIN32
 
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
+#define MOPE_ILLUSTRATOR_WGL
 #define getProcAddress wglGetProcAddress
 #define GL_PROCS_EX GL_PROC(BOOL, wglSwapIntervalEXT, int interval)
 #define GL_PROC(type, name, ...) \
@@ -157,6 +259,74 @@ namespace mope
         inline constexpr float ssboResizeFactor = 2.f;
         static_assert(ssboResizeFactor >= 2.f);
 
+        // How many frames of instance data a persistently mapped SSBO ring holds;
+        // the CPU writes one segment while the GPU may still read the others
+        inline constexpr size_t ssboRingSegments = 3;
+
+        // Ring segments start on multiples of this (the largest value of
+        // GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT seen in the wild)
+        inline constexpr size_t ssboSegmentAlignment = 256;
+
+        // Dirty instances at most this far apart get uploaded as one range
+        inline constexpr size_t dirtyRangeMergeGap = 16;
+
+        // Past this many separate pending ranges, they collapse into one range
+        // spanning all of them
+        inline constexpr size_t dirtyRangeLimit = 64;
+
+        // Batches of model matrices at least this big get split across threads
+        inline constexpr size_t transformParallelThreshold = 16384;
+
+        // Size of each of those pieces (keep it a multiple of 8 for the SIMD paths)
+        inline constexpr size_t transformBatchGrain = 4096;
+        static_assert(transformBatchGrain % 8 == 0);
+
+        // Indexed shader storage binding points that the bind cache keeps track of
+        inline constexpr GLuint storageBindings = 4;
+
+        // Thickness of a render queue depth layer, in world units. Quads whose
+        // depths fall in the same layer are batched by shader and texture
+        // rather than ordered by depth.
+        inline constexpr float renderLayerDepth = 1.f;
+        static_assert(renderLayerDepth > 0.f);
+
+        // How many frames of timings the profiler keeps for its statistics
+        inline constexpr size_t profilerFrames = 1024;
+
+        // How many timed zones the profiler keeps for trace export
+        inline constexpr size_t profilerEvents = 1 << 16;
+
+        // Longest frame time fed into the fixed timestep accumulator, so one
+        // long stall doesn't turn into a burst of catch-up steps
+        inline constexpr double maxFrameTime = 0.25;
+
+        // The frame limiter sleeps until this close to the deadline, then spins
+        inline constexpr double limiterSpinTime = 0.002;
+
+        // Width and height of texture atlas pages
+        inline constexpr int atlasPageSize = 2048;
+
+        // Empty pixels left around each image packed into an atlas
+        inline constexpr int atlasPadding = 1;
+
+        // Seconds per frame the texture manager may spend uploading to the GPU
+        inline constexpr double textureUploadBudget = 0.002;
+
+        // Edge length of a spatial grid cell, in world units; somewhere around
+        // a few sprites across works well
+        inline constexpr float spatialCellSize = 128.f;
+
+        // Pixel canvas storage (and each upload segment) starts on a multiple
+        // of this; a cache line, which also suits the widest SIMD stores
+        inline constexpr size_t canvasAlignment = 64;
+
+        // How many frames of canvas uploads the pixel unpack buffer ring holds
+        inline constexpr size_t canvasUploadSegments = 3;
+
+        // Past this many separate dirty rectangles, a canvas merges them all
+        // into their bounding box
+        inline constexpr size_t canvasDirtyRects = 16;
+
         inline constexpr const char* vertextShaderSource =
             "#version 430 core\n"
             "uniform mat4 u_Projection;"
@@ -164,12 +334,21 @@ namespace mope
             "uniform sampler2D u_Texture;"
             "layout (location = 0) in vec2 i_Vertex;"
             "layout (location = 1) in vec2 i_TexCoord;"
+            "uniform int u_InstanceOffset;"
+            "uniform int u_InstanceRects;"
+            "uniform int u_InstanceIndirect;"
             "layout (std430, binding = 0) buffer MatrixBlock { mat4 u_Models[]; };"
+            "layout (std430, binding = 1) buffer RectBlock { vec4 u_Rects[]; };"
+            "layout (std430, binding = 2) buffer IndexBlock { uint u_Indices[]; };"
             "out vec2 io_TexCoord;"
             "void main() {"
-            "mat4 mvp = u_Projection * u_View * u_Models[gl_InstanceID];"
+            "int i = u_InstanceOffset + gl_InstanceID;"
+            "if (u_InstanceIndirect != 0) i = int(u_Indices[i]);"
+            "mat4 mvp = u_Projection * u_View * u_Models[i];"
             "gl_Position = mvp * vec4(i_Vertex, 0.0, 1.0);"
-            "io_TexCoord = i_TexCoord; }";
+            "io_TexCoord = u_InstanceRects != 0"
+            " ? mix(u_Rects[i].xy, u_Rects[i].zw, i_Vertex + 0.5)"
+            " : i_TexCoord; }";
 
         inline constexpr const char* fragmentShaderSource =
             "#version 430 core\n"
@@ -185,10 +364,36 @@ namespace mope
         void PrintErrors(const char* location);
         void BindProcs();
 
+        // Names of the objects currently bound, so redundant binds can be skipped
+        struct BindCache
+        {
+            GLuint program{ 0 };
+            GLuint texture2D{ 0 };
+            GLuint vertexArray{ 0 };
+            GLuint arrayBuffer{ 0 };
+            GLuint storageBuffer{ 0 };
+            GLuint storageBuffers[settings::storageBindings]{ };
+
+            // binds that actually made it to OpenGL
+            size_t changes{ 0 };
+
+            // slot for the non-indexed binding of a buffer target, if cached
+            GLuint* buffer(GLenum target);
+        };
+
+        BindCache& Bound();
+
+        // Call after binding things without going through the wrappers
+        void ResetBindCache();
+
+        // Drop a deleted buffer from the cache, since its name may be reused
+        void ForgetBuffer(GLuint id);
+
         // Transformation matrices
         constexpr mat4f translation(const vec3f& offsets);
         constexpr mat4f scale(const vec3f& factors);
-        // mat4f rotation(const float angle, const vec3f& axis, const vec3f& origin);
+        // Counterclockwise about the z axis
+        mat4f rotation(const float angle);
 
         // Projection matrices
         constexpr mat4f ortho(
@@ -205,33 +410,80 @@ namespace mope
             const float nr,
             const float fr
         );
+
+        // All zeros if the matrix is singular
+        mat4f inverse(const mat4f& matrix);
     }
 
     using GLuint_deleter_t = void(*)(GLuint*);
 
+    namespace gl
+    {
+        // The thread owning the context; set when the core loop starts. Until
+        // then every thread counts as the render thread.
+        void SetRenderThread();
+        bool OnRenderThread();
+
+        // Run a task on the render thread: right away when called there,
+        // otherwise during its next RunPosted()
+        void Post(std::function<void()> task);
+        void RunPosted();
+
+        // Deletes an object's name where the context lives, whichever thread
+        // lets go of the object last
+        struct Deleter
+        {
+            GLuint_deleter_t deleter;
+            void operator()(GLuint* p_id) const;
+        };
+    }
+
+    /*
+    *   Names are generated on first use, which is an OpenGL call: make or use
+    *   an object on the render thread before handing it to another thread.
+    */
     template<class ptr_t>
     class BindableObject
     {
     public:
         BindableObject(GLuint_deleter_t deleter)
-            : m_id{ new GLuint(0), std::move(deleter) }
+            : m_id{ new GLuint(0), gl::Deleter{ deleter } }
         { }
 
         virtual ~BindableObject() = default;
 
         void Bind() {
-            bind(ID());
+            GLuint id = ID();
+            GLuint* bound = boundSlot();
+            if (bound && *bound == id) {
+                return;
+            }
+            bind(id);
+            ++gl::Bound().changes;
+            if (bound) {
+                *bound = id;
+            }
         }
 
         GLuint ID() {
             GLuint id = *m_id;
+            assert(id || gl::OnRenderThread());
             return id ? id : (generate(m_id.get()), *m_id);
         }
 
+        // The same for every copy of an object, and safe on any thread since
+        // no name gets generated for it
+        const GLuint* Key() const {
+            return m_id.get();
+        }
+
     private:
         virtual void generate(GLuint* p_id) = 0;
         virtual void bind(GLuint id) = 0;
 
+        // where this kind of object's binding is cached, if anywhere
+        virtual GLuint* boundSlot() { return nullptr; }
+
         ptr_t m_id;
     };
 
@@ -244,7 +496,7 @@ namespace mope
     };
 
     class UniqueBindableObject
-        : public BindableObject<std::unique_ptr<GLuint, GLuint_deleter_t>>
+        : public BindableObject<std::unique_ptr<GLuint, gl::Deleter>>
     {
     public:
         using BindableObject::BindableObject;
@@ -273,6 +525,7 @@ namespace mope
     private:
         void generate(GLuint* p_id) override;
         void bind(GLuint id) override;
+        GLuint* boundSlot() override;
 
         GLuint compile(std::string_view srcShader, GLenum type);
         void checkErrors(GLuint object, bool isProgram = false);
@@ -308,6 +561,7 @@ namespace mope
 
     private:
         void bind(GLuint id) override;
+        GLuint* boundSlot() override;
     };
 
 
@@ -323,6 +577,7 @@ namespace mope
     private:
         void generate(GLuint *p_id) override;
         void bind(GLuint id) override;
+        GLuint* boundSlot() override;
     };
 
     class BufferObject : public UniqueBindableObject
@@ -336,8 +591,12 @@ namespace mope
     private:
         bool m_allocated{ false };
 
+        // bind to the plain (non-indexed) target, for uploads
+        void bindTarget();
+
         void generate(GLuint *p_id) override;
         void bind(GLuint id) override;
+        GLuint* boundSlot() override;
 
         virtual GLenum target() = 0;
         virtual GLenum usage() = 0;
@@ -359,19 +618,84 @@ namespace mope
 
     class SSBO : public BufferObject
     {
+    public:
+        explicit SSBO(GLuint index = 0);
+
     private:
         // binding stage is a little different for these
         void bind(GLuint id) override;
+        GLuint* boundSlot() override;
+
+        GLuint m_index;
 
         GLenum target() override;
         GLenum usage() override;
     };
 
+    // Half-open span [begin, end) of elements in some contiguous array
+    struct IndexRange
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    /*
+    *   A shader storage buffer split into several segments that are written in
+    *   turn through a persistent mapping. A fence guards each segment, so the
+    *   CPU only waits if it laps the GPU. Each segment remembers which ranges
+    *   changed since it was last written, so only those get copied. Falls back
+    *   to a single ordinary SSBO if glBufferStorage is unavailable. It may be
+    *   destroyed on any thread; the buffer goes on the render thread.
+    */
+    class SSBORing
+    {
+    public:
+        // `index` is the storage binding point segments get bound to
+        explicit SSBORing(GLuint index = 0);
+        ~SSBORing();
+
+        SSBORing(const SSBORing&) = delete;
+        SSBORing& operator=(const SSBORing&) = delete;
+
+        // Write `count` elements of `stride` bytes from `data` into the next
+        // segment and bind it. `changed` lists the elements modified since the
+        // previous call.
+        void Upload(const void* data, size_t count, size_t stride, const std::vector<IndexRange>& changed);
+
+        // Call after the draw that reads the segment bound by Upload()
+        void Fence();
+
+    private:
+        struct Segment
+        {
+            GLsync fence{ nullptr };
+            std::vector<IndexRange> pending{ };
+            bool stale{ true };
+        };
+
+        size_t segments() const;
+        void grow(size_t size);
+        void release();
+        void wait(Segment& segment);
+
+        GLuint m_index;
+        GLuint m_id{ 0 };
+        uint8_t* m_mapped{ nullptr };
+        size_t m_segmentSize{ 0 };
+        size_t m_current{ 0 };
+        Segment m_segments[settings::ssboRingSegments]{ };
+
+        // used instead of the mapping when persistent buffers aren't supported
+        SSBO m_fallback;
+    };
+
 
     /*========================================================================*\
     |  Camera                                                                  |
     \*========================================================================*/
 
+    class RenderQueue;
+
     class Camera
     {
     public:
@@ -383,7 +707,15 @@ namespace mope
         void ChangePitch(const float delta);
         void Update();
 
+        // Same, but the uniform is set when the queue is flushed
+        void Update(RenderQueue& queue);
+
+        // The view matrix as of the last Update()
+        const mat4f& View() const;
+
     private:
+        void updateView();
+
         // The shader managed by this camera
         Shader m_shader;
         // The name of the view matrix uniform
@@ -396,6 +728,469 @@ namespace mope
         vec3f basisX{ 1.f, 0.f, 0.f };
         vec3f basisY{ 0.f, 1.f, 0.f };
         vec3f basisZ{ 0.f, 0.f, 1.f };
+
+        mat4f m_view{ mat4f::identity() };
+    };
+
+
+    /*========================================================================*\
+    |  Threading                                                               |
+    \*========================================================================*/
+
+    /*
+    *   Each worker keeps its own queue. Tasks enqueued from a worker go on
+    *   that worker's queue and run newest first; idle workers steal the
+    *   oldest tasks from everyone else's. Other threads hand out their tasks
+    *   round-robin.
+    */
+    class ThreadPool
+    {
+    public:
+        explicit ThreadPool(size_t threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Run a task on some worker, eventually. Without workers it runs now.
+        void Enqueue(std::function<void()> task);
+
+        // Enqueue fn and get a future for its result
+        template <class Fn>
+        auto Submit(Fn fn) -> std::future<std::invoke_result_t<Fn>>
+        {
+            auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Fn>()>>(std::move(fn));
+            auto result = task->get_future();
+            Enqueue([task] { (*task)(); });
+            return result;
+        }
+
+        // Call fn(begin, end) over [0, count) in pieces of `grain`. The calling
+        // thread pitches in, and this returns once every piece is done.
+        void ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn);
+
+        size_t Size() const;
+
+        // One worker per hardware thread, minus the caller's
+        static ThreadPool& Shared();
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex{ };
+            std::deque<std::function<void()>> tasks{ };
+        };
+
+        void work(size_t index);
+
+        // Run the newest task on queue `home`, or else steal the oldest from
+        // another queue. False if every queue was empty.
+        bool runOne(size_t home);
+
+        std::vector<std::unique_ptr<Queue>> m_queues{ };
+        std::vector<std::thread> m_workers{ };
+
+        // tasks enqueued but not yet taken; workers sleep while it's zero
+        std::atomic<size_t> m_pending{ 0 };
+        // where the next task from outside the pool goes
+        std::atomic<size_t> m_next{ 0 };
+
+        std::mutex m_mutex{ };
+        std::condition_variable m_cv{ };
+        bool m_stop{ false };
+    };
+
+
+    /*========================================================================*\
+    |  Transforms                                                              |
+    \*========================================================================*/
+
+    // Structure-of-arrays view of translate/rotate/scale transforms
+    struct TransformArrays
+    {
+        const float* px;
+        const float* py;
+        const float* pz;
+        const float* sx;
+        const float* sy;
+        const float* sz;
+        const float* rotation;
+
+        TransformArrays offset(size_t n) const;
+    };
+
+    namespace simd
+    {
+        enum class Level { Scalar, SSE, AVX2 };
+
+        // Best level the running CPU supports
+        Level Detect();
+
+        // Level BuildModels() uses; starts out as Detect()
+        Level Active();
+        void SetActive(Level level);
+
+        const char* Name(Level level);
+    }
+
+    // Write the column-major model matrix (translate * rotate * scale) of each
+    // transform into `out`. Only the matrix assembly is vectorized: sin and cos
+    // still come from the C library one lane at a time, which keeps every level
+    // bit-identical to the scalar path. Large batches are spread over
+    // ThreadPool::Shared().
+    void BuildModels(const TransformArrays& in, size_t count, mat4f* out);
+    void BuildModels(const TransformArrays& in, size_t count, mat4f* out, simd::Level level);
+
+
+    /*========================================================================*\
+    |  Culling                                                                 |
+    \*========================================================================*/
+
+    // Axis-aligned box in world space
+    struct Bounds
+    {
+        vec3f min;
+        vec3f max;
+
+        // Around the unit quad sprites are drawn with, once `model` is applied
+        static Bounds OfQuad(const mat4f& model);
+    };
+
+    // The clipping volume of a view-projection matrix
+    class Frustum
+    {
+    public:
+        explicit Frustum(const mat4f& viewProjection);
+
+        bool Intersects(const Bounds& bounds) const;
+
+        // World-space box around the whole volume (unbounded if the matrix
+        // can't be inverted)
+        const Bounds& Extent() const;
+
+        // Normalized device depth of a point; farther is greater
+        float Depth(const vec3f& point) const;
+
+    private:
+        mat4f m_matrix;
+        vec4f m_planes[6];
+        Bounds m_extent;
+    };
+
+    // Loose uniform grid over the xy plane. Each id lives in the cell holding
+    // the center of its bounds, and queries widen their search by (a little
+    // over) the largest half-size among the ids present, so nothing straddling
+    // a cell edge gets missed.
+    class SpatialGrid
+    {
+    public:
+        explicit SpatialGrid(float cellSize = settings::spatialCellSize);
+
+        // Add an id, or move it if it's already here
+        void Insert(uint32_t id, const Bounds& bounds);
+        bool Remove(uint32_t id);
+        bool Contains(uint32_t id) const;
+        void Clear();
+        size_t Size() const;
+
+        // Append the ids whose bounds overlap `region` in the xy plane
+        void Query(const Bounds& region, std::vector<uint32_t>& out) const;
+
+        // Append the ids whose bounds cover `point`
+        void Query(vec2f point, std::vector<uint32_t>& out) const;
+
+        // Append the ids whose bounds intersect `frustum`
+        void Query(const Frustum& frustum, std::vector<uint32_t>& out) const;
+
+    private:
+        struct Item
+        {
+            Bounds bounds{ };
+            // largest half-size of the bounds
+            float reach{ 0.f };
+            int64_t cell{ 0 };
+            uint32_t slot{ 0 };
+            bool live{ false };
+        };
+
+        int cellCoord(float position) const;
+        int64_t cellKey(int x, int y) const;
+        void detach(uint32_t id);
+
+        // Reaches are counted in buckets, four to a power of two, and m_margin
+        // is kept at the top of the highest occupied one. Items growing and
+        // shrinking as they rotate only ever move it a bucket or so.
+        static constexpr uint32_t reachBuckets = 1024;
+        static uint32_t reachBucket(float reach);
+        static float bucketTop(uint32_t bucket);
+        void addReach(float reach);
+        void dropReach(float reach);
+
+        template <class Test>
+        void query(const Bounds& region, Test&& test, std::vector<uint32_t>& out) const;
+
+        float m_cellSize;
+        float m_margin{ 0.f };
+        // live items in each reach bucket, and one past the highest occupied
+        uint32_t m_reaches[reachBuckets]{ };
+        uint32_t m_topReach{ 0 };
+        size_t m_size{ 0 };
+        std::unordered_map<int64_t, std::vector<uint32_t>> m_cells{ };
+        std::vector<Item> m_items{ };
+    };
+
+
+    /*========================================================================*\
+    |  Texture manager                                                         |
+    \*========================================================================*/
+
+    // Where one image landed in an atlas, in the texture coordinates that
+    // Sprite::SetTexture() takes
+    struct AtlasRegion
+    {
+        size_t page{ 0 };
+        vec2f leftBottom{ 0.f, 0.f };
+        vec2f rightTop{ 1.f, 1.f };
+    };
+
+    struct Atlas
+    {
+        std::vector<Texture2D> pages{ };
+        std::unordered_map<std::string, AtlasRegion> regions{ };
+
+        // Look up a packed image by the filename it was loaded from
+        const AtlasRegion& Region(const std::string& filename) const;
+        Texture2D& Page(const AtlasRegion& region);
+    };
+
+    // Skyline bottom-left rectangle packer for one atlas page
+    class SkylinePacker
+    {
+    public:
+        SkylinePacker(int width, int height);
+
+        // Find room for a width x height rectangle. Returns false if it doesn't fit.
+        bool Pack(int width, int height, int& x, int& y);
+
+    private:
+        // Top edge of the packed area over [x, x + width)
+        struct Segment
+        {
+            int x;
+            int y;
+            int width;
+        };
+
+        // Lowest y a rectangle can rest at starting on segment i, or -1
+        int fit(size_t i, int width, int height) const;
+
+        int m_width;
+        int m_height;
+        std::vector<Segment> m_skyline{ };
+    };
+
+    // Decodes images on worker threads and uploads them on the GL thread.
+    // Loading the same path twice, or two files with the same contents, gives
+    // back the same Texture2D. Poll the futures rather than waiting on them from
+    // the GL thread, since nothing gets uploaded until Update() runs. The
+    // workers only start with the first load.
+    class TextureManager
+    {
+    public:
+        explicit TextureManager(size_t threads = std::max(std::thread::hardware_concurrency(), 2u) - 1);
+
+        TextureManager(const TextureManager&) = delete;
+        TextureManager& operator=(const TextureManager&) = delete;
+
+        std::shared_future<Texture2D> Load(const std::string& filename);
+
+        // Decode and pack a batch of images into shared pages. With a cache file,
+        // a later call with the same (unchanged) files maps the packed pages
+        // straight from disk and skips decoding.
+        std::shared_future<Atlas> LoadAtlas(const std::vector<std::string>& filenames, const std::string& cacheFile = "");
+
+        // The texture if it has finished loading, otherwise (or if it failed)
+        // a placeholder
+        Texture2D Get(const std::shared_future<Texture2D>& texture);
+
+        // A 1x1 texture to draw while loads are in flight
+        Texture2D Placeholder();
+
+        // Run pending GPU uploads. Call from the GL thread; stops once `budget`
+        // seconds have gone by, after at least one upload.
+        void Update(double budget);
+
+        // Uploads waiting for Update()
+        size_t Pending();
+
+    private:
+        // A decoded image, owned by stb_image or by a packed page buffer
+        struct Image
+        {
+            int width{ 0 };
+            int height{ 0 };
+            int channels{ 0 };
+            std::shared_ptr<const uint8_t> pixels{ };
+        };
+
+        using TexturePromise = std::shared_ptr<std::promise<Texture2D>>;
+        using AtlasPromise = std::shared_ptr<std::promise<Atlas>>;
+
+        static std::vector<uint8_t> readFile(const std::string& filename);
+        static Image decode(const std::vector<uint8_t>& bytes, int channels, const std::string& filename);
+        static Texture2D upload(const Image& image);
+
+        // Identifies a list of files by their names, sizes and modification times
+        static uint64_t sourceHash(const std::vector<std::string>& filenames);
+        static void writeAtlas(const std::string& cacheFile, uint64_t hash,
+            const std::vector<Image>& pages, const std::unordered_map<std::string, AtlasRegion>& regions);
+
+        // These run on the workers
+        void loadTexture(const std::string& filename, TexturePromise promise, std::shared_future<Texture2D> future);
+
+        // Fulfil a texture load, and every load of the same contents waiting on it
+        void settle(uint64_t hash, const TexturePromise& promise, const Texture2D& texture, std::exception_ptr error);
+        void loadAtlas(const std::vector<std::string>& filenames, const std::string& cacheFile, AtlasPromise promise);
+        bool readAtlas(const std::string& cacheFile, uint64_t hash, AtlasPromise promise);
+        void postAtlas(std::vector<Image> pages, std::unordered_map<std::string, AtlasRegion> regions, AtlasPromise promise);
+
+        // Queue work for the GL thread
+        void post(std::function<void()> upload);
+
+        // The worker pool, started on first use
+        ThreadPool& workers();
+
+        std::mutex m_mutex{ };
+        std::unordered_map<std::string, std::shared_future<Texture2D>> m_byPath{ };
+        std::unordered_map<uint64_t, std::shared_future<Texture2D>> m_byHash{ };
+        // loads that turned out to duplicate one still in flight
+        std::unordered_map<uint64_t, std::vector<TexturePromise>> m_waiting{ };
+        std::deque<std::function<void()>> m_uploads{ };
+
+        Texture2D m_placeholder{ };
+        bool m_hasPlaceholder{ false };
+
+        size_t m_threads;
+        std::once_flag m_started{ };
+
+        // last, so workers are joined before anything they touch goes away
+        std::unique_ptr<ThreadPool> m_workers{ };
+    };
+
+
+    /*========================================================================*\
+    |  Pixel canvas                                                            |
+    \*========================================================================*/
+
+    /*
+    *   An RGBA image drawn on by the CPU and mirrored into a texture. Fills
+    *   and blits run a row at a time through the simd::Active() kernels, and
+    *   every primitive clips to the canvas. Drawing records the rectangles it
+    *   touched; Upload() merges them and streams only those to the texture,
+    *   through a ring of persistently mapped pixel unpack buffers so the copy
+    *   doesn't wait on the GPU. Coordinates are pixels from the bottom left,
+    *   the same way up as the texture. Like the bindable objects, a canvas
+    *   may be destroyed on any thread.
+    */
+    class PixelCanvas
+    {
+    public:
+        // A rectangle of pixels to blit from, with rows `stride` pixels apart
+        struct Source
+        {
+            const Pixel* pixels;
+            int width;
+            int height;
+            int stride;
+        };
+
+        PixelCanvas(int width, int height);
+        ~PixelCanvas();
+
+        PixelCanvas(const PixelCanvas&) = delete;
+        PixelCanvas& operator=(const PixelCanvas&) = delete;
+
+        int Width() const;
+        int Height() const;
+
+        // Width() pixels per row, bottom row first. Call MarkDirty() after
+        // writing through this.
+        Pixel* Data();
+        const Pixel* Data() const;
+
+        // Part of the canvas, for blitting elsewhere (say, a sprite sheet cell)
+        Source Region(int x, int y, int width, int height) const;
+
+        // Have the next Upload() send this rectangle
+        void MarkDirty(int x, int y, int width, int height);
+
+        Pixel GetPixel(int x, int y) const;
+        void Draw(int x, int y, Pixel color);
+
+        void Clear(Pixel color);
+        void FillRect(int x, int y, int width, int height, Pixel color);
+        void DrawLine(int x0, int y0, int x1, int y1, Pixel color);
+        void DrawCircle(int x, int y, int radius, Pixel color);
+        void FillCircle(int x, int y, int radius, Pixel color);
+
+        // Copy `source` with its bottom left at (x, y), each of its pixels
+        // becoming a `scale` x `scale` block
+        void Blit(int x, int y, const Source& source, int scale = 1);
+
+        // The same, blended over what's there by the source's alpha
+        void BlendBlit(int x, int y, const Source& source, int scale = 1);
+
+        // Send the dirty rectangles to the texture. Call on the render thread,
+        // while nothing is drawing.
+        void Upload();
+
+        // What Upload() keeps up to date; made by the first Upload()
+        Texture2D Texture() const;
+
+    private:
+        // Half-open on both axes
+        struct Rect
+        {
+            int x0;
+            int y0;
+            int x1;
+            int y1;
+        };
+
+        Pixel* row(int y);
+        // The part of a rectangle on the canvas; wide enough not to overflow
+        // for any int coordinates and sizes
+        Rect clip(int64_t x0, int64_t y0, int64_t x1, int64_t y1) const;
+        void fill(Rect rect, Pixel color);
+        void markDirty(Rect rect);
+        void blit(int x, int y, const Source& source, int scale, bool blend);
+
+        // Copy each dirty rectangle to the unpack ring, or straight from the
+        // canvas without one
+        void uploadMapped();
+        void uploadDirect();
+        void grow(size_t size);
+        void release();
+
+        int m_width;
+        int m_height;
+        Pixel* m_pixels{ nullptr };
+
+        std::vector<Rect> m_dirty{ };
+        // one scaled source row, for blits that scale
+        std::vector<Pixel> m_scratch{ };
+        // a blit's source, when it's a region of this canvas
+        std::vector<Pixel> m_copy{ };
+
+        Texture2D m_texture{ };
+        bool m_made{ false };
+
+        // the unpack buffer ring; one fence per segment, as with SSBORing
+        GLuint m_buffer{ 0 };
+        uint8_t* m_mapped{ nullptr };
+        size_t m_segmentSize{ 0 };
+        size_t m_current{ 0 };
+        GLsync m_fences[settings::canvasUploadSegments]{ };
     };
 
 
@@ -417,6 +1212,8 @@ namespace mope
         Instance(vec3f position, vec3f scale, float rotation);
         Instance(Data data);
 
+        static mat4f ComputeModel(const Data& data);
+
         const mat4f* Model();
         vec3f Position() const;
         vec3f Scale() const;
@@ -424,11 +1221,11 @@ namespace mope
 
         void MoveTo(vec3f position);
         void SetScale(vec3f factors);
-        //void SetAngle(float);
+        void SetAngle(float angle);
 
         void Move(const vec3f& displacement);
         void ScaleBy(const vec3f& factors);
-        //void Rotate(float);
+        void Rotate(float angle);
 
     protected:
         Data m_data;
@@ -436,6 +1233,107 @@ namespace mope
         bool m_recompute{ true };
     };
 
+    /*
+    *   Densely packed instance data for InstancedSprite. Instances are referred
+    *   to by generational handles, removal swaps the last instance into the
+    *   hole, and modified instances are tracked so that only they need their
+    *   matrices rebuilt and uploaded.
+    */
+    class InstanceStore
+    {
+    public:
+        struct Handle
+        {
+            static constexpr uint32_t invalid = 0xFFFFFFFF;
+
+            uint32_t index{ invalid };
+            uint32_t generation{ 0 };
+
+            bool operator==(const Handle& other) const;
+            bool operator!=(const Handle& other) const;
+        };
+
+        Handle Add(Instance::Data data);
+        bool Remove(Handle handle);
+        bool Contains(Handle handle) const;
+        void Clear();
+
+        Instance::Data Get(Handle handle) const;
+        void Set(Handle handle, Instance::Data data);
+
+        void MoveTo(Handle handle, vec3f position);
+        void SetScale(Handle handle, vec3f factors);
+        void SetAngle(Handle handle, float angle);
+
+        void Move(Handle handle, const vec3f& displacement);
+        void ScaleBy(Handle handle, const vec3f& factors);
+        void Rotate(Handle handle, float angle);
+
+        // Give an instance its own texture rect, in place of the sprite's
+        void SetRect(Handle handle, vec2f leftBottom, vec2f rightTop);
+
+        // The rect of every instance not given its own; the owning sprite
+        // keeps this in step with its texture rect
+        void SetDefaultRect(vec2f leftBottom, vec2f rightTop);
+
+        size_t Size() const;
+        const mat4f* Models() const;
+
+        // The handle of whatever currently sits at a dense index
+        Handle HandleAt(size_t idx) const;
+
+        // Texture rects as (left, bottom, right, top), once any have been set
+        const vec4f* Rects() const;
+        bool HasRects() const;
+
+        // Rebuild the matrices of modified instances. Returns the dense ranges
+        // touched since the last call, sorted and coalesced.
+        const std::vector<IndexRange>& Update();
+
+    private:
+        struct Slot
+        {
+            uint32_t dense;
+            uint32_t generation;
+        };
+
+        // instance transforms, one array per component
+        struct Columns
+        {
+            std::vector<float> px, py, pz;
+            std::vector<float> sx, sy, sz;
+            std::vector<float> rotation;
+
+            void push(const Instance::Data& data);
+            void pop();
+            void clear();
+            void copy(size_t from, size_t to);
+            void set(size_t idx, const Instance::Data& data);
+            Instance::Data get(size_t idx) const;
+            TransformArrays view() const;
+        };
+
+        size_t denseIndex(Handle handle) const;
+        void markDirty(size_t idx);
+
+        // indexed by handle
+        std::vector<Slot> m_slots{ };
+        std::vector<uint32_t> m_freeSlots{ };
+
+        // indexed densely
+        Columns m_data{ };
+        std::vector<mat4f> m_models{ };
+        std::vector<vec4f> m_rects{ };
+        std::vector<bool> m_ownRects{ };
+        std::vector<uint32_t> m_owners{ };
+        std::vector<bool> m_dirtyFlags{ };
+        bool m_hasRects{ false };
+        vec4f m_defaultRect{ 0.f, 0.f, 1.f, 1.f };
+
+        std::vector<uint32_t> m_dirty{ };
+        std::vector<IndexRange> m_ranges{ };
+    };
+
     class Sprite
     {
     public:
@@ -449,6 +1347,10 @@ namespace mope
 
         void Render();
 
+        // Hand this sprite's quads to a queue instead of drawing them directly.
+        // Sprites that don't override this just Render() on the spot.
+        virtual void Submit(RenderQueue& queue);
+
     protected:
         vec2f m_leftBottom{ 0.f, 0.f };
         vec2f m_rightTop{ 1.f, 1.f };
@@ -470,6 +1372,8 @@ namespace mope
 
     private:
         bool m_prepared{ false };
+        // texture coordinates changed since the VBO was last filled
+        bool m_verticesDirty{ false };
     };
 
     class BasicSprite : public Sprite, public Instance
@@ -485,6 +1389,8 @@ namespace mope
             vec2f rightTop = { 1.f, 1.f }
         );
 
+        void Submit(RenderQueue& queue) override;
+
     private:
         void drawCall() override;
     };
@@ -494,19 +1400,68 @@ namespace mope
     public:
         using Sprite::Sprite;
 
-        void AddInstance(std::shared_ptr<Instance> instance);
-        std::shared_ptr<Instance> MakeInstance(
+        InstanceStore::Handle MakeInstance(
             vec3f position = vec3f{ 0.f, 0.f, -1.f },
             vec3f scale = vec3f{ 1.f, 1.f, 1.f },
             float rotation = 0
         );
-        std::shared_ptr<Instance> MakeInstance(Instance::Data data);
+        InstanceStore::Handle MakeInstance(Instance::Data data);
+        bool DropInstance(InstanceStore::Handle handle);
 
-    protected:
+        // Modify instances through here
+        InstanceStore& Instances();
+
+        void Submit(RenderQueue& queue) override;
+
+        struct CullStats
+        {
+            size_t drawn{ 0 };
+            size_t culled{ 0 };
+        };
+
+        // Only draw instances inside this view-projection's frustum, optionally
+        // farthest first so that blending comes out right
+        void SetViewProjection(const mat4f& viewProjection, bool backToFront = false);
+        void DisableCulling();
+
+        // Numbers from the most recent draw
+        const CullStats& LastFrame() const;
+
+        // Append the instances whose quads overlap `region` in the xy plane,
+        // or cover `point`
+        void Query(const Bounds& region, std::vector<InstanceStore::Handle>& out);
+        void Query(vec2f point, std::vector<InstanceStore::Handle>& out);
+
+    protected:
         void drawCall() override;
 
-        std::vector<std::weak_ptr<Instance>> m_instances{ };
-        size_t m_bufferSize{ 0 };
+        // remember what changed since the last upload
+        void collectChanges();
+
+        // start keeping m_grid in step with the instances
+        void useIndex();
+        void updateIndex(const std::vector<IndexRange>& changed);
+
+        // fill m_visible for the current view-projection
+        void cull();
+
+        InstanceStore m_instances{ };
+        SSBORing m_ring{ 0 };
+        SSBORing m_rectRing{ 1 };
+        SSBORing m_indexRing{ 2 };
+        std::vector<IndexRange> m_changed{ };
+
+        SpatialGrid m_grid{ };
+        bool m_indexed{ false };
+        bool m_culling{ false };
+        bool m_backToFront{ false };
+        mat4f m_viewProjection{ mat4f::identity() };
+        std::vector<uint32_t> m_visible{ };
+        // the whole of m_visible, as the index ring wants it
+        std::vector<IndexRange> m_visibleRange{ };
+        std::vector<uint32_t> m_found{ };
+        std::vector<std::pair<float, uint32_t>> m_depthOrder{ };
+        CullStats m_stats{ };
     };
 
     class AnimatedSprite : public BasicSprite
@@ -529,19 +1484,338 @@ namespace mope
 
         void Next();
         void SwitchTo(size_t idx, bool ignore_elapsed = true);
+
+        // Move the animation along; Render(elapsed) does this too. Makes no
+        // GL calls, so it's safe from the update thread when pipelining
+        void Advance(double elapsed);
         void Render(double elapsed);
 
     private:
         void nextFrame();
         void updateTexture();
 
-        bool m_ignoreElapsed;
+        bool m_ignoreElapsed{ false };
         size_t m_currentFrame{ 0 };
         double m_currentFrameTime{ 0 };
         std::vector<Frame> m_frames{ };
     };
 
 
+    /*========================================================================*\
+    |  Animation                                                               |
+    \*========================================================================*/
+
+    // A run of frames out of one texture, shared by everything that plays it
+    struct AnimationClip
+    {
+        enum class Mode { Loop, PingPong, OneShot };
+
+        struct Frame
+        {
+            vec2f leftBottom;
+            vec2f rightTop;
+            double duration;
+
+            // if nonzero, reaching this frame raises an event carrying the tag
+            uint32_t tag{ 0 };
+        };
+
+        std::vector<Frame> frames{ };
+        Mode mode{ Mode::Loop };
+
+        double Length() const;
+    };
+
+    struct AnimationEvent
+    {
+        enum class Kind { Frame, Looped, Finished };
+
+        InstanceStore::Handle instance;
+        Kind kind;
+        uint32_t tag;
+    };
+
+    // Plays clips on the instances of an InstanceStore by writing the current
+    // frame of each into its texture rect, so that a whole animated crowd still
+    // goes out in one instanced draw
+    class Animator
+    {
+    public:
+        using Clip = std::shared_ptr<const AnimationClip>;
+        using Callback = std::function<void(const std::vector<AnimationEvent>&)>;
+
+        // Start `clip` `time` seconds in, replacing whatever the instance was playing
+        void Play(InstanceStore::Handle instance, Clip clip, float speed = 1.f, double time = 0.0);
+        bool Stop(InstanceStore::Handle instance);
+        bool Playing(InstanceStore::Handle instance) const;
+        void SetSpeed(InstanceStore::Handle instance, float speed);
+        void Clear();
+        size_t Size() const;
+
+        // Advance every playing instance and write new frames into `store`.
+        // Finished one-shots stop playing, and so do instances removed from
+        // the store, without raising any more events.
+        void Update(double elapsed, InstanceStore& store);
+
+        // Called at the end of each Update() that raised any events, with all of them
+        void OnEvents(Callback callback);
+        const std::vector<AnimationEvent>& Events() const;
+
+    private:
+        // a clip flattened for frame lookups
+        struct Track
+        {
+            Clip clip{ };
+            std::vector<double> ends{ };
+            double length{ 0.0 };
+            size_t users{ 0 };
+        };
+
+        static constexpr uint32_t none = 0xFFFFFFFF;
+
+        uint32_t track(Clip clip);
+        void release(uint32_t idx);
+        uint32_t find(InstanceStore::Handle instance) const;
+        void remove(size_t idx);
+
+        std::vector<Track> m_tracks{ };
+        std::vector<uint32_t> m_freeTracks{ };
+        std::unordered_map<const AnimationClip*, uint32_t> m_trackIndex{ };
+
+        // indexed by handle slot
+        std::vector<uint32_t> m_lookup{ };
+
+        // indexed densely
+        std::vector<InstanceStore::Handle> m_instances{ };
+        std::vector<uint32_t> m_track{ };
+        std::vector<double> m_time{ };
+        std::vector<float> m_speed{ };
+        std::vector<uint32_t> m_frame{ };
+
+        std::vector<uint32_t> m_changed{ };
+        std::vector<uint32_t> m_stopped{ };
+        std::vector<AnimationEvent> m_events{ };
+        Callback m_callback{ };
+    };
+
+
+    /*========================================================================*\
+    |  Render queue                                                            |
+    \*========================================================================*/
+
+    /*
+    *   Collects textured quads from any number of sprites, radix sorts them by
+    *   depth layer, then shader, then texture, and draws each run sharing a
+    *   shader and texture as one instanced call over a shared quad. Depth is
+    *   only sorted down to settings::renderLayerDepth: within a layer, quads
+    *   come out in batch order, so overlapping translucent quads that must
+    *   blend in a particular order belong in different layers.
+    *   Shaders are expected to follow the default vertex shader's interface.
+    */
+    class RenderQueue
+    {
+    public:
+        struct Stats
+        {
+            size_t items{ 0 };
+            size_t culled{ 0 };
+            size_t drawCalls{ 0 };
+            size_t stateChanges{ 0 };
+            size_t bytesUploaded{ 0 };
+        };
+
+        // Layers of greater depth are drawn first. That is back to front under
+        // gl::ortho(), which puts greater z farther away; a gl::perspective()
+        // camera looks down -z, so there it is front to back.
+        void Submit(
+            const Shader& shader,
+            const Texture2D& texture,
+            float depth,
+            vec2f leftBottom,
+            vec2f rightTop,
+            const mat4f& model
+        );
+
+        // Set a uniform when the queue is flushed, ahead of any drawing
+        void SetUniform(const Shader& shader, const char* name, int value);
+        void SetUniform(const Shader& shader, const char* name, float value);
+        void SetUniform(const Shader& shader, const char* name, const vec2f& value);
+        void SetUniform(const Shader& shader, const char* name, const mat4f& value);
+
+        // Draw everything submitted since the last flush, then forget it
+        void Flush();
+
+        // Drop submissions outside this view-projection's frustum
+        void SetViewProjection(const mat4f& viewProjection);
+        void DisableCulling();
+
+        // Numbers from the most recent Flush()
+        const Stats& LastFrame() const;
+
+    private:
+        struct Uniform
+        {
+            Shader shader;
+            std::string name;
+            std::variant<int, float, vec2f, mat4f> value;
+        };
+
+        void prepare();
+        void sort();
+        void setUniforms();
+        uint32_t shaderIndex(const Shader& shader);
+        uint32_t textureIndex(const Texture2D& texture);
+
+        // recorded uniforms, in the order they were set
+        std::vector<Uniform> m_uniforms{ };
+
+        // shaders and textures referenced this frame
+        std::vector<Shader> m_shaders{ };
+        std::vector<Texture2D> m_textures{ };
+        // keyed on the objects themselves; any missing names get generated
+        // when the queue is flushed on the render thread
+        std::unordered_map<const GLuint*, uint32_t> m_shaderLookup{ };
+        std::unordered_map<const GLuint*, uint32_t> m_textureLookup{ };
+
+        // submissions, in submission order
+        std::vector<uint64_t> m_keys{ };
+        std::vector<mat4f> m_models{ };
+        std::vector<vec4f> m_rects{ };
+
+        // sort scratch and the sorted upload
+        std::vector<uint64_t> m_sortedKeys{ };
+        std::vector<uint32_t> m_order{ };
+        std::vector<uint64_t> m_keyScratch{ };
+        std::vector<uint32_t> m_orderScratch{ };
+        std::vector<mat4f> m_sortedModels{ };
+        std::vector<vec4f> m_sortedRects{ };
+
+        VAO m_vao{ };
+        VBO m_vbo{ };
+        EBO m_ebo{ };
+        SSBO m_modelBuffer{ 0 };
+        SSBO m_rectBuffer{ 1 };
+        size_t m_capacity{ 0 };
+        bool m_prepared{ false };
+
+        Frustum m_frustum{ mat4f::identity() };
+        bool m_culling{ false };
+        size_t m_culled{ 0 };
+
+        Stats m_stats{ };
+    };
+
+
+    /*========================================================================*\
+    |  Profiler                                                                |
+    \*========================================================================*/
+
+    /*
+    *   Times the phases of each frame plus any zones the user opens, keeps the
+    *   most recent frames for percentile statistics, and can export the zones
+    *   as a Chrome trace (chrome://tracing, Perfetto). A phase zone opened
+    *   inside another on the same thread has its time taken out of the outer
+    *   phase, so the phases of a frame never count anything twice.
+    */
+    class Profiler
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        // The phases IllustratorCore times on its own. Wait is only used when
+        // pipelined: the render thread idling until the simulation thread has
+        // a frame ready, whose own time goes in a "Simulation" zone.
+        enum class Phase { Input, Simulate, Update, Wait, Submit, Present, Sleep, count };
+
+        struct Summary
+        {
+            size_t samples{ 0 };
+            double mean{ 0 };
+            double p50{ 0 };
+            double p95{ 0 };
+            double p99{ 0 };
+            double max{ 0 };
+        };
+
+        // Times a zone until it goes out of scope
+        class Scope
+        {
+        public:
+            Scope(Profiler* profiler, const char* name, int phase = -1);
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            Profiler* m_profiler;
+            const char* m_name;
+            int m_phase;
+            clock::time_point m_begin;
+
+            // the phase zone this one sits inside, and time spent in phases
+            // nested inside this one
+            Scope* m_outer{ nullptr };
+            clock::duration m_nested{ };
+        };
+
+        Profiler();
+
+        // `name` must outlive the profiler (a string literal, usually)
+        Scope Zone(const char* name);
+        Scope Zone(Phase phase);
+
+        void BeginFrame();
+        void EndFrame();
+
+        void SetEnabled(bool enabled);
+        bool Enabled() const;
+
+        // Statistics over the retained frames, in seconds
+        Summary Frames() const;
+        Summary Phases(Phase phase) const;
+        // Statistics over the retained zones with this name
+        Summary Zones(std::string_view name) const;
+
+        // Returns false if the file couldn't be written
+        bool WriteChromeTrace(const std::string& filename) const;
+
+        static const char* Name(Phase phase);
+
+    private:
+        struct Event
+        {
+            const char* name;
+            clock::time_point begin;
+            clock::time_point end;
+            size_t thread;
+        };
+
+        struct FrameSample
+        {
+            double total;
+            double phases[static_cast<size_t>(Phase::count)];
+        };
+
+        void record(const char* name, int phase, clock::time_point begin, clock::time_point end, clock::duration nested);
+        static Summary summarize(std::vector<double>& samples);
+
+        std::atomic<bool> m_enabled{ true };
+        clock::time_point m_epoch;
+
+        // zones close on any thread, so everything below is under m_mutex
+        mutable std::mutex m_mutex{ };
+        clock::time_point m_frameBegin;
+        FrameSample m_current{ };
+
+        std::vector<FrameSample> m_frames{ };
+        size_t m_nextFrame{ 0 };
+
+        std::vector<Event> m_events{ };
+        size_t m_nextEvent{ 0 };
+    };
+
+
     /*========================================================================*\
     |  Illustrator                                                             |
     \*========================================================================*/
@@ -553,6 +1827,8 @@ namespace mope
     class BaseRenderer
     {
     public:
+        virtual ~BaseRenderer() = default;
+
         // Display graphics
         virtual void showFrame() = 0;
     };
@@ -560,6 +1836,8 @@ namespace mope
     class BaseWindow
     {
     public:
+        virtual ~BaseWindow() = default;
+
         // Retrieve an abstract object that represents control of a rendering context
         virtual std::unique_ptr<BaseRenderer> getRenderer() = 0;
 
@@ -603,6 +1881,9 @@ namespace mope
         // Set the projection matrix on the default shader
         void setProjection(const mat4f& projection_matrix);
 
+        // The matrix last given to setProjection()
+        const mat4f& projection();
+
         // Toggle whether to display the FPS in the title bar
         void toggleFps();
 
@@ -612,8 +1893,41 @@ namespace mope
         // Get the current dimensions of the screen client area
         vec2i clientDims();
 
+        // Call gameFixedUpdate() every `step` seconds of game time, catching up
+        // as needed before each gameUpdate(). Zero goes back to a variable step.
+        void setFixedTimestep(double step);
+
+        // Cap the frame rate, sleeping then spinning until each frame is due.
+        // Zero removes the cap.
+        void setFrameLimit(double fps);
+
+        // How far the current frame lies between the last fixed step and the
+        // next one, in [0, 1), for interpolating what gets drawn. Always 1
+        // without a fixed timestep.
+        double interpolationAlpha();
+
+        // Run gameFixedUpdate() and gameUpdate() on a simulation thread working
+        // a frame ahead of rendering, with `snapshots` frames of submissions in
+        // flight: 2 overlaps each update with drawing the frame before, 3 lets
+        // the simulation get one more frame ahead. Zero keeps everything on one
+        // thread. Read when the loop starts, so call it before run() or from
+        // gameStart(). While pipelined, updates must not call OpenGL: submit
+        // through frameQueue() and gl::Post() anything else.
+        void setPipelined(size_t snapshots);
+
+        // Where gameUpdate() submits this frame's drawing. Flushed after
+        // gameUpdate() returns, or on the render thread when pipelined.
+        // Anything gameStart() submits goes out with the first frame.
+        RenderQueue& frameQueue();
+
         Shader defaultShader{ };
 
+        // Frame timings; open zones of your own with profiler.Zone("name")
+        Profiler profiler{ };
+
+        // Background image loading; uploads finish a few at a time each frame
+        TextureManager textures{ };
+
         // Internal representation of keystates
         std::bitset<256> m_pressed{ };
         std::bitset<256> m_released{ };
@@ -628,17 +1942,47 @@ namespace mope
         // Return false to end the rendering loop and begin closing.
         virtual bool gameUpdate(double deltaTime);
 
+        // With a fixed timestep set, this is called zero or more times per
+        // frame before gameUpdate(), always with the same step.
+        // Return false to end the rendering loop and begin closing.
+        virtual bool gameFixedUpdate(double step);
+
         // User should override this to release OpenGL resources before context is destroyed.
         // Generally not needed if RAII wrappers are used for resources.
         virtual void gameEnd();
 
+        // Everything an update gets to see of the frame it's working on
+        struct InputSnapshot
+        {
+            std::bitset<256> pressed{ };
+            std::bitset<256> released{ };
+            std::bitset<256> held{ };
+            int xDelta{ 0 };
+            int yDelta{ 0 };
+            int width{ 0 };
+            int height{ 0 };
+            double frameTime{ 0 };
+        };
+
+        // One frame of drawing on its way from the simulation to the screen
+        struct Snapshot
+        {
+            RenderQueue queue{ };
+            bool keepGoing{ true };
+        };
+
         // The main driver of activity
         void coreLoop();
+        void pipelinedLoop(BaseRenderer& renderer);
+        void simulationLoop();
 
         // Updates during loop
         void updateSize(bool initial = false);
         void updateTitle();
         void updateInputs();
+        void applyInput(const InputSnapshot& input);
+        bool updateSimulation();
+        void limitFrame();
 
         // access to the window that we are working with
         std::unique_ptr<BaseWindow> m_window;
@@ -650,9 +1994,12 @@ namespace mope
         // once set, try to maintain this aspect ratio
         float m_initialAspect{ 0 };
 
-        // x and y deltas of mouse on last frame
-        int m_xDelta{ 0 };
-        int m_yDelta{ 0 };
+        // last matrix handed to setProjection()
+        mat4f m_projection{ mat4f::identity() };
+
+        // input as collected on the main thread, and as the updates see it
+        InputSnapshot m_incoming{ };
+        InputSnapshot m_input{ };
 
         // Timing/FPS mechanisms
         unsigned int m_frameCount{ 0 };
@@ -660,6 +2007,29 @@ namespace mope
         double m_fpsUpdateTimer{ 0 };
         bool m_showFps{ true };
 
+        // Fixed timestep and pacing
+        double m_fixedStep{ 0 };
+        double m_accumulator{ 0 };
+        double m_framePeriod{ 0 };
+        std::chrono::steady_clock::time_point m_nextFrame{ };
+
+        // gameUpdate()'s submissions when not pipelined
+        RenderQueue m_queue{ };
+
+        // Pipelining; snapshots move from free to the simulation to ready to
+        // the screen and back, all under m_pipeMutex
+        size_t m_pipelineDepth{ 0 };
+        std::vector<std::unique_ptr<Snapshot>> m_snapshots{ };
+        std::deque<size_t> m_freeSnapshots{ };
+        std::deque<size_t> m_readySnapshots{ };
+        std::deque<InputSnapshot> m_inputs{ };
+        size_t m_recording{ 0 };
+        bool m_stopSimulation{ false };
+        bool m_simulationDone{ false };
+        std::exception_ptr m_simulationError{ };
+        std::mutex m_pipeMutex{ };
+        std::condition_variable m_pipeCv{ };
+
         // title of the game/window, defined in constructor
         const std::string m_title;
     };
@@ -694,6 +2064,123 @@ namespace mope
         using IllustratorCore::m_held;
         using IllustratorCore::m_released;
     };
+
+
+#if defined MOPE_ILLUSTRATOR_HEADLESS
+    /*========================================================================*\
+    |  Headless                                                                |
+    \*========================================================================*/
+
+    namespace headless
+    {
+        // One per OpenGL entry point
+        enum class Proc : size_t
+        {
+#define GL_PROC(type, name, ...) name,
+            GL_PROC_LIST
+#undef GL_PROC
+            count
+        };
+
+        const char* Name(Proc proc);
+
+        // Everything the null driver has seen since the last Reset()
+        struct Recording
+        {
+            size_t calls[static_cast<size_t>(Proc::count)]{ };
+
+            size_t frames{ 0 };
+            // CPU time between consecutive showFrame() calls
+            double frameSeconds{ 0 };
+
+            // passed to glBufferData/glBufferSubData/glBufferStorage
+            size_t bufferBytes{ 0 };
+            // passed to glTexImage2D/glTexSubImage2D
+            size_t textureBytes{ 0 };
+
+            size_t programBinds{ 0 };
+            size_t textureBinds{ 0 };
+            size_t bufferBinds{ 0 };
+            size_t vertexArrayBinds{ 0 };
+
+            size_t drawCalls{ 0 };
+            size_t instances{ 0 };
+
+            // glBufferData/glBufferSubData calls with no buffer bound to their
+            // target, which OpenGL rejects
+            size_t unboundWrites{ 0 };
+
+            size_t Calls(Proc proc) const;
+            void Reset();
+
+            // The counters as a JSON object, for diffing between runs
+            void WriteJson(std::ostream& out) const;
+        };
+
+        Recording& Recorder();
+
+        // Writes through persistent mappings are invisible to the driver. Turn
+        // this off (before the illustrator starts) to push every upload
+        // through glBufferSubData, where it gets counted.
+        void SetPersistentMapping(bool enabled);
+
+        // Input to replay on a given frame
+        struct InputFrame
+        {
+            std::bitset<256> keys{ };
+            int xDelta{ 0 };
+            int yDelta{ 0 };
+        };
+
+        class Window;
+
+        class Renderer : public BaseRenderer
+        {
+        public:
+            explicit Renderer(Window& window);
+
+            void showFrame() override;
+
+        private:
+            Window& m_window;
+            std::chrono::steady_clock::time_point m_last;
+        };
+
+        // A window that runs for a fixed number of frames, replaying `script`
+        // (frame i gets script[i], or nothing once the script runs out)
+        class Window : public BaseWindow
+        {
+        public:
+            Window(int width, int height, size_t frames, std::vector<InputFrame> script = { });
+
+            std::unique_ptr<BaseRenderer> getRenderer() override;
+            void setTitle(std::string_view title) override;
+            int getWidth() override;
+            int getHeight() override;
+            int retrieveXDelta() override;
+            int retrieveYDelta() override;
+            std::bitset<256> getKeyStates() override;
+            bool running() override;
+            void close() override;
+
+            size_t Frame() const;
+            const std::string& Title() const;
+
+        private:
+            friend class Renderer;
+
+            const InputFrame& current() const;
+
+            int m_width;
+            int m_height;
+            size_t m_frames;
+            size_t m_frame{ 0 };
+            bool m_closed{ false };
+            std::string m_title{ };
+            std::vector<InputFrame> m_script;
+        };
+    }
+#endif
 }
 
 #endif // MOPE_ILLUSTRATOR_H
@@ -707,13 +2194,35 @@ namespace mope
 |  Implementation                                                              |
 \*============================================================================*/
 
-#define GL_PROC(type, name, ...) static name##_t* name;
+#define GL_PROC(type, name, ...) name##_t* name;
 GL_PROC_LIST
 #undef GL_PROC
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#if defined __x86_64__ || defined _M_X64 || defined __i386__ || defined _M_IX86
+#define MOPE_ILLUSTRATOR_X86
+#include <immintrin.h>
+#if defined _MSC_VER
+#include <intrin.h>
+#define MOPE_TARGET(isa)
+#else
+#define MOPE_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+#if defined _WIN32 && !defined MOPE_ILLUSTRATOR_WGL
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#elif !defined _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace mope::gl
 {
     void BindProcs()
@@ -731,6 +2240,96 @@ namespace mope::gl
         }
     }
 
+    GLuint* BindCache::buffer(GLenum target)
+    {
+        switch (target) {
+        case GL_ARRAY_BUFFER: return &arrayBuffer;
+        case GL_SHADER_STORAGE_BUFFER: return &storageBuffer;
+        // element array bindings belong to the VAO, so don't cache those
+        default: return nullptr;
+        }
+    }
+
+    BindCache& Bound()
+    {
+        static BindCache cache{ };
+        return cache;
+    }
+
+    void ResetBindCache()
+    {
+        size_t changes = Bound().changes;
+        Bound() = BindCache{ };
+        Bound().changes = changes;
+    }
+
+    namespace
+    {
+        std::atomic<bool> hasRenderThread{ false };
+        std::thread::id renderThread{ };
+        std::mutex postedMutex{ };
+        std::vector<std::function<void()>> posted{ };
+    }
+
+    void SetRenderThread()
+    {
+        renderThread = std::this_thread::get_id();
+        hasRenderThread.store(true, std::memory_order_release);
+    }
+
+    bool OnRenderThread()
+    {
+        return !hasRenderThread.load(std::memory_order_acquire)
+            || std::this_thread::get_id() == renderThread;
+    }
+
+    void Post(std::function<void()> task)
+    {
+        if (OnRenderThread()) {
+            task();
+            return;
+        }
+        std::lock_guard<std::mutex> lock{ postedMutex };
+        posted.push_back(std::move(task));
+    }
+
+    void RunPosted()
+    {
+        std::vector<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lock{ postedMutex };
+            tasks.swap(posted);
+        }
+        for (auto& task : tasks) {
+            task();
+        }
+    }
+
+    void Deleter::operator()(GLuint* p_id) const
+    {
+        // never generated, so there's nothing for OpenGL to do
+        if (!*p_id) {
+            delete p_id;
+            return;
+        }
+        Post([deleter = deleter, p_id] { deleter(p_id); });
+    }
+
+    void ForgetBuffer(GLuint id)
+    {
+        BindCache& cache = Bound();
+        for (GLuint* slot : { &cache.arrayBuffer, &cache.storageBuffer }) {
+            if (*slot == id) {
+                *slot = 0;
+            }
+        }
+        for (GLuint& slot : cache.storageBuffers) {
+            if (slot == id) {
+                slot = 0;
+            }
+        }
+    }
+
     constexpr mat4f translation(const vec3f& offsets)
     {
         mat4f res = mat4f::identity();
@@ -749,6 +2348,16 @@ namespace mope::gl
         return res;
     }
 
+    mat4f rotation(const float angle)
+    {
+        mat4f res = mat4f::identity();
+        res[0][0] = std::cos(angle);
+        res[0][1] = std::sin(angle);
+        res[1][0] = -res[0][1];
+        res[1][1] = res[0][0];
+        return res;
+    }
+
     constexpr mat4f ortho(
         const float left, const float right,
         const float bottom, const float top,
@@ -777,57 +2386,345 @@ namespace mope::gl
             0.f, 0.f, 2.f * fr * nr / (nr - fr), 0.f
         };
     }
+
+    mat4f inverse(const mat4f& matrix)
+    {
+        // cofactor expansion; works on the flat array the same in either major order
+        const float* m = &matrix[0][0];
+        float inv[16];
+
+        inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15]
+            + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+        inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15]
+            - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+        inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15]
+            + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+        inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14]
+            - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+        inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15]
+            - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+        inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15]
+            + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+        inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15]
+            - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+        inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14]
+            + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+        inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15]
+            + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+        inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15]
+            - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+        inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15]
+            + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+        inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14]
+            - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+        inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11]
+            - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+        inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11]
+            + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+        inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11]
+            - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+        inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10]
+            + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+        float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+
+        mat4f res;
+        float* out = &res[0][0];
+        for (size_t i = 0; i < 16; ++i) {
+            out[i] = det == 0.f ? 0.f : inv[i] / det;
+        }
+        return res;
+    }
 }
 
 namespace mope
 {
-    IllustratorCore::IllustratorCore(std::unique_ptr<BaseWindow> window, std::string_view title)
-        : m_window{ std::move(window) }
-        , m_title{ title }
-    { }
+    /*========================================================================*\
+    |  Profiler                                                                |
+    \*========================================================================*/
 
-    void IllustratorCore::run()
+    namespace
     {
-        if (m_window->running())
-        {
-            coreLoop();
+        // innermost phase zone open on this thread
+        thread_local Profiler::Scope* openPhase = nullptr;
+    }
+
+    Profiler::Scope::Scope(Profiler* profiler, const char* name, int phase)
+        : m_profiler{ profiler }
+        , m_name{ name }
+        , m_phase{ phase }
+        , m_begin{ clock::now() }
+    {
+        if (m_phase >= 0) {
+            m_outer = openPhase;
+            openPhase = this;
         }
     }
 
-    void IllustratorCore::setClearColor(Pixel color)
+    Profiler::Scope::~Scope()
     {
-        constexpr float factor = 1.f / 255.f;
-        setClearColor(factor * (vec4f)color);
+        clock::time_point end = clock::now();
+        if (m_phase >= 0) {
+            openPhase = m_outer;
+            if (m_outer) {
+                m_outer->m_nested += end - m_begin;
+            }
+        }
+        if (m_profiler->m_enabled) {
+            m_profiler->record(m_name, m_phase, m_begin, end, m_nested);
+        }
     }
 
-    void IllustratorCore::setClearColor(vec4f color)
+    Profiler::Profiler()
+        : m_epoch{ clock::now() }
+        , m_frameBegin{ m_epoch }
+    { }
+
+    Profiler::Scope Profiler::Zone(const char* name)
     {
-        glClearColor(color.x(), color.y(), color.z(), color.w());
+        return Scope{ this, name };
     }
 
-    void IllustratorCore::setProjection(const mat4f& projection_matrix)
+    Profiler::Scope Profiler::Zone(Phase phase)
     {
-        defaultShader.SetUniform("u_Projection", projection_matrix);
+        return Scope{ this, Name(phase), static_cast<int>(phase) };
     }
 
-    void IllustratorCore::toggleFps()
+    void Profiler::BeginFrame()
     {
-        m_showFps = !m_showFps;
-        if (m_showFps) {
-            updateTitle();
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_frameBegin = clock::now();
+        m_current = FrameSample{ };
+    }
+
+    void Profiler::EndFrame()
+    {
+        if (!m_enabled) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        std::chrono::duration<double> total = clock::now() - m_frameBegin;
+        m_current.total = total.count();
+
+        if (m_frames.size() < settings::profilerFrames) {
+            m_frames.push_back(m_current);
         }
         else {
-            m_window->setTitle(m_title);
-            m_frameCount = 0;
-            m_fpsUpdateTimer = 0.0;
+            m_frames[m_nextFrame] = m_current;
         }
+        m_nextFrame = (m_nextFrame + 1) % settings::profilerFrames;
     }
 
-    void IllustratorCore::updateSize(bool initial)
+    void Profiler::SetEnabled(bool enabled)
     {
-        // get current window size
-        int new_width = m_window->getWidth();
-        int new_height = m_window->getHeight();
+        m_enabled = enabled;
+    }
+
+    bool Profiler::Enabled() const
+    {
+        return m_enabled;
+    }
+
+    Profiler::Summary Profiler::Frames() const
+    {
+        std::vector<double> samples;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            for (const FrameSample& frame : m_frames) {
+                samples.push_back(frame.total);
+            }
+        }
+        return summarize(samples);
+    }
+
+    Profiler::Summary Profiler::Phases(Phase phase) const
+    {
+        std::vector<double> samples;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            for (const FrameSample& frame : m_frames) {
+                samples.push_back(frame.phases[static_cast<size_t>(phase)]);
+            }
+        }
+        return summarize(samples);
+    }
+
+    Profiler::Summary Profiler::Zones(std::string_view name) const
+    {
+        std::vector<double> samples;
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            for (const Event& event : m_events) {
+                if (name == event.name) {
+                    std::chrono::duration<double> duration = event.end - event.begin;
+                    samples.push_back(duration.count());
+                }
+            }
+        }
+        return summarize(samples);
+    }
+
+    bool Profiler::WriteChromeTrace(const std::string& filename) const
+    {
+        std::ofstream out{ filename };
+        if (!out) {
+            return false;
+        }
+
+        auto micros = [](clock::duration duration) {
+            return std::chrono::duration<double, std::micro>(duration).count();
+        };
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        out << "{\"traceEvents\":[";
+        for (size_t i = 0; i < m_events.size(); ++i) {
+            const Event& event = m_events[i];
+            out << (i ? "," : "") << "\n{\"name\":\"";
+            for (const char* c = event.name; *c; ++c) {
+                if (*c == '"' || *c == '\\') {
+                    out << '\\';
+                }
+                out << *c;
+            }
+            out << "\",\"ph\":\"X\",\"pid\":0"
+                << ",\"tid\":" << event.thread
+                << ",\"ts\":" << micros(event.begin - m_epoch)
+                << ",\"dur\":" << micros(event.end - event.begin) << "}";
+        }
+        out << "\n]}\n";
+
+        return static_cast<bool>(out);
+    }
+
+    const char* Profiler::Name(Phase phase)
+    {
+        switch (phase) {
+        case Phase::Input: return "Input";
+        case Phase::Simulate: return "Simulate";
+        case Phase::Update: return "Update";
+        case Phase::Wait: return "Wait";
+        case Phase::Submit: return "Submit";
+        case Phase::Present: return "Present";
+        case Phase::Sleep: return "Sleep";
+        default: return "Unknown";
+        }
+    }
+
+    void Profiler::record(const char* name, int phase, clock::time_point begin, clock::time_point end, clock::duration nested)
+    {
+        // small numbers read better in trace viewers than hashed thread ids
+        static std::atomic<size_t> threads{ 0 };
+        thread_local size_t thread = threads++;
+
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        if (phase >= 0) {
+            std::chrono::duration<double> duration = end - begin - nested;
+            m_current.phases[phase] += duration.count();
+        }
+
+        Event event{ name, begin, end, thread };
+        if (m_events.size() < settings::profilerEvents) {
+            m_events.push_back(event);
+        }
+        else {
+            m_events[m_nextEvent] = event;
+        }
+        m_nextEvent = (m_nextEvent + 1) % settings::profilerEvents;
+    }
+
+    Profiler::Summary Profiler::summarize(std::vector<double>& samples)
+    {
+        Summary summary{ };
+        summary.samples = samples.size();
+        if (samples.empty()) {
+            return summary;
+        }
+
+        std::sort(samples.begin(), samples.end());
+        auto rank = [&](double p) {
+            size_t idx = static_cast<size_t>(std::ceil(p * samples.size()));
+            return samples[std::max(idx, size_t{ 1 }) - 1];
+        };
+
+        double sum = 0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        summary.mean = sum / samples.size();
+        summary.p50 = rank(0.50);
+        summary.p95 = rank(0.95);
+        summary.p99 = rank(0.99);
+        summary.max = samples.back();
+        return summary;
+    }
+
+
+    /*========================================================================*\
+    |  Illustrator                                                             |
+    \*========================================================================*/
+
+    IllustratorCore::IllustratorCore(std::unique_ptr<BaseWindow> window, std::string_view title)
+        : m_window{ std::move(window) }
+        , m_title{ title }
+    { }
+
+    void IllustratorCore::run()
+    {
+        if (m_window->running())
+        {
+            coreLoop();
+        }
+    }
+
+    void IllustratorCore::setClearColor(Pixel color)
+    {
+        constexpr float factor = 1.f / 255.f;
+        setClearColor(factor * (vec4f)color);
+    }
+
+    void IllustratorCore::setClearColor(vec4f color)
+    {
+        gl::Post([color] { glClearColor(color.x(), color.y(), color.z(), color.w()); });
+    }
+
+    void IllustratorCore::setProjection(const mat4f& projection_matrix)
+    {
+        if (gl::OnRenderThread()) {
+            defaultShader.SetUniform("u_Projection", projection_matrix);
+        }
+        else {
+            frameQueue().SetUniform(defaultShader, "u_Projection", projection_matrix);
+        }
+        m_projection = projection_matrix;
+    }
+
+    const mat4f& IllustratorCore::projection()
+    {
+        return m_projection;
+    }
+
+    void IllustratorCore::toggleFps()
+    {
+        // the title belongs to the main thread
+        gl::Post([this] {
+            m_showFps = !m_showFps;
+            if (m_showFps) {
+                updateTitle();
+            }
+            else {
+                m_window->setTitle(m_title);
+                m_frameCount = 0;
+                m_fpsUpdateTimer = 0.0;
+            }
+        });
+    }
+
+    void IllustratorCore::updateSize(bool initial)
+    {
+        // get current window size
+        int new_width = m_window->getWidth();
+        int new_height = m_window->getHeight();
 
         // make changes only if the window size has changed
         if (new_width != m_width || new_height != m_height) {
@@ -875,23 +2772,111 @@ namespace mope
 
     void IllustratorCore::updateInputs()
     {
-        m_xDelta = m_window->retrieveXDelta();
-        m_yDelta = m_window->retrieveYDelta();
+        m_incoming.xDelta = m_window->retrieveXDelta();
+        m_incoming.yDelta = m_window->retrieveYDelta();
 
         auto new_states = m_window->getKeyStates();
-        m_pressed = new_states & ~m_held;
-        m_released = m_held & ~new_states;
-        m_held = new_states;
+        m_incoming.pressed = new_states & ~m_incoming.held;
+        m_incoming.released = m_incoming.held & ~new_states;
+        m_incoming.held = new_states;
+
+        m_incoming.width = m_width;
+        m_incoming.height = m_height;
+        m_incoming.frameTime = m_frameTime;
+    }
+
+    void IllustratorCore::applyInput(const InputSnapshot& input)
+    {
+        m_input = input;
+        m_pressed = input.pressed;
+        m_released = input.released;
+        m_held = input.held;
     }
 
     vec2i IllustratorCore::mouseDeltas()
     {
-        return { m_xDelta, m_yDelta };
+        return { m_input.xDelta, m_input.yDelta };
     }
 
     vec2i IllustratorCore::clientDims()
     {
-        return { m_width, m_height };
+        return { m_input.width, m_input.height };
+    }
+
+    void IllustratorCore::setFixedTimestep(double step)
+    {
+        m_fixedStep = std::max(step, 0.0);
+        m_accumulator = 0;
+    }
+
+    void IllustratorCore::setFrameLimit(double fps)
+    {
+        // pacing happens on the main thread
+        gl::Post([this, fps] {
+            m_framePeriod = fps > 0 ? 1.0 / fps : 0;
+            m_nextFrame = std::chrono::steady_clock::now();
+        });
+    }
+
+    double IllustratorCore::interpolationAlpha()
+    {
+        return m_fixedStep > 0 ? m_accumulator / m_fixedStep : 1.0;
+    }
+
+    bool IllustratorCore::updateSimulation()
+    {
+        if (m_fixedStep <= 0) {
+            return true;
+        }
+
+        m_accumulator += std::min(m_input.frameTime, settings::maxFrameTime);
+        while (m_accumulator >= m_fixedStep) {
+            m_accumulator -= m_fixedStep;
+            if (!gameFixedUpdate(m_fixedStep)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void IllustratorCore::setPipelined(size_t snapshots)
+    {
+        // a single snapshot would leave nothing to overlap
+        m_pipelineDepth = snapshots ? std::max(snapshots, size_t{ 2 }) : 0;
+    }
+
+    RenderQueue& IllustratorCore::frameQueue()
+    {
+        if (!m_snapshots.empty()) {
+            return m_snapshots[m_recording]->queue;
+        }
+        return m_queue;
+    }
+
+    void IllustratorCore::limitFrame()
+    {
+        using namespace std::chrono;
+
+        if (m_framePeriod <= 0) {
+            return;
+        }
+
+        m_nextFrame += duration_cast<steady_clock::duration>(duration<double>(m_framePeriod));
+        auto now = steady_clock::now();
+        if (m_nextFrame <= now) {
+            // running behind; don't try to make it up with short frames
+            m_nextFrame = now;
+            return;
+        }
+
+        // sleep is coarse, so only sleep through most of the wait
+        auto spin = duration_cast<steady_clock::duration>(duration<double>(settings::limiterSpinTime));
+        if (m_nextFrame - now > spin) {
+            std::this_thread::sleep_for(m_nextFrame - now - spin);
+        }
+        while (steady_clock::now() < m_nextFrame) {
+            std::this_thread::yield();
+        }
     }
 
     bool IllustratorCore::gameStart()
@@ -905,6 +2890,11 @@ namespace mope
         return false;
     }
 
+    bool IllustratorCore::gameFixedUpdate(double)
+    {
+        return true;
+    }
+
     void IllustratorCore::gameEnd()
     { }
 
@@ -912,13 +2902,16 @@ namespace mope
     {
         auto renderer = m_window->getRenderer();
 
+        gl::SetRenderThread();
+        gl::BindProcs();
         updateSize(true);
+        m_input.width = m_width;
+        m_input.height = m_height;
 
-        gl::BindProcs();
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-#if defined _WIN32
+#if defined MOPE_ILLUSTRATOR_WGL
         wglSwapIntervalEXT(0);
 #else
         // Support other platforms?
@@ -929,34 +2922,259 @@ namespace mope
         defaultShader.SetUniform("u_Projection", mat4f::identity());
         defaultShader.SetUniform("u_View", mat4f::identity());
 
+        // made here, since updates may fall back on it from any thread
+        textures.Placeholder();
+
         // Give the app a chance to set things up
-        if (gameStart()) {
-            std::chrono::system_clock::time_point t1 = std::chrono::system_clock::now();
-            std::chrono::system_clock::time_point t2;
+        bool started = gameStart();
+        if (started && m_pipelineDepth) {
+            pipelinedLoop(*renderer);
+        }
+        else if (started) {
+            std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::time_point t2;
+            m_nextFrame = t1;
 
             while (m_window->running())
             {
+                using Phase = Profiler::Phase;
+                profiler.BeginFrame();
+
                 // Find out how much time has passsed
-                t2 = std::chrono::system_clock::now();
+                t2 = std::chrono::steady_clock::now();
                 std::chrono::duration<double> durElapsed = t2 - t1;
                 m_frameTime = durElapsed.count();
                 t1 = t2;
 
                 // Do all our regular updates
+                {
+                    auto zone = profiler.Zone(Phase::Input);
+                    updateTitle();
+                    updateSize();
+                    updateInputs();
+                    applyInput(m_incoming);
+                }
+
+                bool keepGoing;
+                {
+                    auto zone = profiler.Zone(Phase::Simulate);
+                    keepGoing = updateSimulation();
+                }
+
+                // the update draws into the cleared frame and records into
+                // m_queue, so it runs inside the Submit zone with a zone of
+                // its own
+                {
+                    auto submit = profiler.Zone(Phase::Submit);
+                    textures.Update(settings::textureUploadBudget);
+                    glClear(GL_COLOR_BUFFER_BIT);
+
+                    if (keepGoing) {
+                        auto zone = profiler.Zone(Phase::Update);
+                        keepGoing = gameUpdate(m_frameTime);
+                    }
+
+                    m_queue.Flush();
+                }
+
+                // show the frame
+                if (keepGoing) {
+                    auto zone = profiler.Zone(Phase::Present);
+                    renderer->showFrame();
+                }
+                else {
+                    m_window->close();
+                }
+
+                {
+                    auto zone = profiler.Zone(Phase::Sleep);
+                    limitFrame();
+                }
+
+                profiler.EndFrame();
+            }
+        }
+
+        // Give the app a chance to clean up, then release whatever it let go
+        // of from other threads while the context is still around
+        gl::RunPosted();
+        gameEnd();
+        gl::RunPosted();
+    }
+
+    void IllustratorCore::pipelinedLoop(BaseRenderer& renderer)
+    {
+        using Phase = Profiler::Phase;
+
+        m_snapshots.clear();
+        m_freeSnapshots.clear();
+        m_readySnapshots.clear();
+        m_inputs.clear();
+        for (size_t i = 0; i < m_pipelineDepth; ++i) {
+            m_snapshots.push_back(std::make_unique<Snapshot>());
+            m_freeSnapshots.push_back(i);
+        }
+        m_stopSimulation = false;
+        m_simulationDone = false;
+        m_simulationError = nullptr;
+
+        std::thread simulation{ [this] { simulationLoop(); } };
+
+        // inputs handed over whose frames haven't been drawn yet; past this
+        // many, wait for the oldest one rather than run further ahead
+        size_t inFlight = 0;
+        const size_t ahead = m_pipelineDepth - 1;
+
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point t2;
+        m_nextFrame = t1;
+
+        while (m_window->running())
+        {
+            profiler.BeginFrame();
+
+            // Find out how much time has passsed
+            t2 = std::chrono::steady_clock::now();
+            std::chrono::duration<double> durElapsed = t2 - t1;
+            m_frameTime = durElapsed.count();
+            t1 = t2;
+
+            // Collect input for the simulation's next frame
+            {
+                auto zone = profiler.Zone(Phase::Input);
                 updateTitle();
                 updateSize();
                 updateInputs();
+                {
+                    std::lock_guard<std::mutex> lock{ m_pipeMutex };
+                    m_inputs.push_back(m_incoming);
+                }
+                m_pipeCv.notify_all();
+                ++inFlight;
+            }
 
-                // show the frame
+            // the first few frames only prime the pipeline, and go out blank
+            Snapshot* frame = nullptr;
+            size_t slot = 0;
+            if (inFlight > ahead) {
+                auto zone = profiler.Zone(Phase::Wait);
+                std::unique_lock<std::mutex> lock{ m_pipeMutex };
+                m_pipeCv.wait(lock, [this] { return !m_readySnapshots.empty() || m_simulationDone; });
+                if (m_readySnapshots.empty()) {
+                    break;
+                }
+                slot = m_readySnapshots.front();
+                m_readySnapshots.pop_front();
+                frame = m_snapshots[slot].get();
+                --inFlight;
+            }
+
+            {
+                auto zone = profiler.Zone(Phase::Submit);
+                // tasks posted while that frame was being made
+                gl::RunPosted();
+                textures.Update(settings::textureUploadBudget);
                 glClear(GL_COLOR_BUFFER_BIT);
-                gameUpdate(m_frameTime)
-                    ? renderer->showFrame()
-                    : m_window->close();
+                // whatever gameStart() submitted before there were snapshots
+                // to record into; empty after the first frame
+                m_queue.Flush();
+                if (frame) {
+                    frame->queue.Flush();
+                }
             }
+
+            // show the frame
+            if (!frame || frame->keepGoing) {
+                auto zone = profiler.Zone(Phase::Present);
+                renderer.showFrame();
+            }
+            else {
+                m_window->close();
+            }
+
+            if (frame) {
+                {
+                    std::lock_guard<std::mutex> lock{ m_pipeMutex };
+                    m_freeSnapshots.push_back(slot);
+                }
+                m_pipeCv.notify_all();
+            }
+
+            {
+                auto zone = profiler.Zone(Phase::Sleep);
+                limitFrame();
+            }
+
+            profiler.EndFrame();
         }
 
-        // Give the app a chance to clean up
-        gameEnd();
+        {
+            std::lock_guard<std::mutex> lock{ m_pipeMutex };
+            m_stopSimulation = true;
+        }
+        m_pipeCv.notify_all();
+        simulation.join();
+
+        // draws and deletions left over from frames that never made it out,
+        // and whatever the simulation posted after the last frame
+        m_snapshots.clear();
+        gl::RunPosted();
+
+        if (m_simulationError) {
+            std::rethrow_exception(m_simulationError);
+        }
+    }
+
+    void IllustratorCore::simulationLoop()
+    {
+        try {
+            for (;;) {
+                InputSnapshot input;
+                {
+                    std::unique_lock<std::mutex> lock{ m_pipeMutex };
+                    m_pipeCv.wait(lock, [this] {
+                        return m_stopSimulation || (!m_inputs.empty() && !m_freeSnapshots.empty());
+                    });
+                    if (m_stopSimulation) {
+                        break;
+                    }
+                    input = std::move(m_inputs.front());
+                    m_inputs.pop_front();
+                    m_recording = m_freeSnapshots.front();
+                    m_freeSnapshots.pop_front();
+                }
+
+                applyInput(input);
+
+                // phases are the main thread's, so this gets a zone of its own
+                bool keepGoing;
+                {
+                    auto zone = profiler.Zone("Simulation");
+                    keepGoing = updateSimulation() && gameUpdate(input.frameTime);
+                }
+
+                m_snapshots[m_recording]->keepGoing = keepGoing;
+                {
+                    std::lock_guard<std::mutex> lock{ m_pipeMutex };
+                    m_readySnapshots.push_back(m_recording);
+                    m_simulationDone = !keepGoing;
+                }
+                m_pipeCv.notify_all();
+
+                if (!keepGoing) {
+                    break;
+                }
+            }
+        }
+        catch (...) {
+            m_simulationError = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ m_pipeMutex };
+            m_simulationDone = true;
+        }
+        m_pipeCv.notify_all();
     }
 
 
@@ -1009,6 +3227,18 @@ namespace mope
     }
 
     void Camera::Update()
+    {
+        updateView();
+        m_shader.SetUniform(m_uniform.c_str(), m_view);
+    }
+
+    void Camera::Update(RenderQueue& queue)
+    {
+        updateView();
+        queue.SetUniform(m_shader, m_uniform.c_str(), m_view);
+    }
+
+    void Camera::updateView()
     {
         // Update the transformation basis vectors
         basisZ = (vec3f{ sin(m_yaw) * cos(m_pitch), -sin(m_pitch), cos(m_yaw) * cos(m_pitch) }.unitf());
@@ -1026,34 +3256,443 @@ namespace mope
         // Build the translation matrix (inverse)
         mat4f translation = gl::translation(-m_position);
 
-        // Upload to the shader
-        m_shader.SetUniform(m_uniform.c_str(), changeOfBase * translation);
+        m_view = changeOfBase * translation;
+    }
+
+    const mat4f& Camera::View() const
+    {
+        return m_view;
     }
 
 
     /*========================================================================*\
-    |  Shader                                                                  |
+    |  Threading                                                               |
     \*========================================================================*/
 
-    Shader::Shader()
-        : SharedBindableObject(
-            [](GLuint* p_id) {
-                glDeleteProgram(*p_id);
-                delete p_id;
-            })
-    { }
-
-    void Shader::Make(std::string_view srcVertex, std::string_view srcFragment)
+    namespace
     {
-        GLuint shader_vert = compile(srcVertex, GL_VERTEX_SHADER);
-        checkErrors(shader_vert);
+        // The pool and queue of the worker running on this thread, if any
+        thread_local ThreadPool* currentPool{ nullptr };
+        thread_local size_t currentWorker{ 0 };
+    }
 
-        GLuint shader_frag = compile(srcFragment, GL_FRAGMENT_SHADER);
-        checkErrors(shader_frag);
+    ThreadPool::ThreadPool(size_t threads)
+    {
+        for (size_t i = 0; i < threads; ++i) {
+            m_queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            m_workers.emplace_back([this, i] { work(i); });
+        }
+    }
 
-        GLuint id = ID();
-        glAttachShader(id, shader_vert);
-        glAttachShader(id, shader_frag);
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        for (std::thread& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    void ThreadPool::Enqueue(std::function<void()> task)
+    {
+        if (m_workers.empty()) {
+            task();
+            return;
+        }
+
+        // counted first, so a worker that wakes for it keeps looking until it shows up
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            ++m_pending;
+        }
+
+        size_t index = currentPool == this
+            ? currentWorker
+            : m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+        {
+            Queue& queue = *m_queues[index];
+            std::lock_guard<std::mutex> lock{ queue.mutex };
+            queue.tasks.push_back(std::move(task));
+        }
+        m_cv.notify_one();
+    }
+
+    void ThreadPool::ParallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& fn)
+    {
+        grain = std::max(grain, size_t{ 1 });
+        const size_t pieces = (count + grain - 1) / grain;
+        if (pieces <= 1 || m_workers.empty()) {
+            if (count) {
+                fn(0, count);
+            }
+            return;
+        }
+
+        // shared, since helpers may only get around to starting after we return
+        struct State
+        {
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            std::mutex mutex{ };
+            std::condition_variable cv{ };
+        };
+        auto state = std::make_shared<State>();
+
+        auto run = [state, pieces, count, grain, &fn] {
+            size_t piece;
+            while ((piece = state->next.fetch_add(1)) < pieces) {
+                size_t begin = piece * grain;
+                fn(begin, std::min(begin + grain, count));
+                if (state->done.fetch_add(1) + 1 == pieces) {
+                    std::lock_guard<std::mutex> lock{ state->mutex };
+                    state->cv.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = std::min(m_workers.size(), pieces - 1);
+        for (size_t i = 0; i < helpers; ++i) {
+            Enqueue(run);
+        }
+        run();
+
+        std::unique_lock<std::mutex> lock{ state->mutex };
+        state->cv.wait(lock, [&] { return state->done == pieces; });
+    }
+
+    size_t ThreadPool::Size() const
+    {
+        return m_workers.size();
+    }
+
+    ThreadPool& ThreadPool::Shared()
+    {
+        static ThreadPool pool{ std::max(std::thread::hardware_concurrency(), 1u) - 1 };
+        return pool;
+    }
+
+    void ThreadPool::work(size_t index)
+    {
+        currentPool = this;
+        currentWorker = index;
+
+        for (;;) {
+            if (runOne(index)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock{ m_mutex };
+            m_cv.wait(lock, [this] { return m_stop || m_pending > 0; });
+            if (m_stop && m_pending == 0) {
+                return;
+            }
+        }
+    }
+
+    bool ThreadPool::runOne(size_t home)
+    {
+        std::function<void()> task;
+        for (size_t i = 0; i < m_queues.size() && !task; ++i) {
+            Queue& queue = *m_queues[(home + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock{ queue.mutex };
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+        if (!task) {
+            return false;
+        }
+
+        --m_pending;
+        task();
+        return true;
+    }
+
+
+    /*========================================================================*\
+    |  Transforms                                                              |
+    \*========================================================================*/
+
+    TransformArrays TransformArrays::offset(size_t n) const
+    {
+        return { px + n, py + n, pz + n, sx + n, sy + n, sz + n, rotation + n };
+    }
+
+    namespace
+    {
+        // Shared by every level: SIMD has no sin/cos that matches the C library,
+        // and everything after this is exact multiplies and copies
+        inline void sinCos(float angle, float& c, float& s)
+        {
+            if (angle == 0.f) {
+                c = 1.f;
+                s = 0.f;
+            }
+            else {
+                c = std::cos(angle);
+                s = std::sin(angle);
+            }
+        }
+
+        void buildModelsScalar(const TransformArrays& in, size_t count, mat4f* out)
+        {
+            for (size_t i = 0; i < count; ++i) {
+                float c, s;
+                sinCos(in.rotation[i], c, s);
+
+                float* m = &out[i][0][0];
+                m[0] = c * in.sx[i];    m[1] = s * in.sx[i];    m[2] = 0.f;         m[3] = 0.f;
+                m[4] = -s * in.sy[i];   m[5] = c * in.sy[i];    m[6] = 0.f;         m[7] = 0.f;
+                m[8] = 0.f;             m[9] = 0.f;             m[10] = in.sz[i];   m[11] = 0.f;
+                m[12] = in.px[i];       m[13] = in.py[i];       m[14] = in.pz[i];   m[15] = 1.f;
+            }
+        }
+
+#if defined MOPE_ILLUSTRATOR_X86
+        // Scatter four lanes of the matrix components into four matrices:
+        // a/b are column 0, c/d column 1
+        MOPE_TARGET("sse2")
+        inline void storeModels4(__m128 a, __m128 b, __m128 c, __m128 d,
+            __m128 sz, __m128 px, __m128 py, __m128 pz, mat4f* out)
+        {
+            const __m128 zero = _mm_setzero_ps();
+            __m128 one = _mm_set1_ps(1.f);
+
+            __m128 ab_lo = _mm_unpacklo_ps(a, b);
+            __m128 ab_hi = _mm_unpackhi_ps(a, b);
+            __m128 cd_lo = _mm_unpacklo_ps(c, d);
+            __m128 cd_hi = _mm_unpackhi_ps(c, d);
+            __m128 z_lo = _mm_unpacklo_ps(sz, zero);
+            __m128 z_hi = _mm_unpackhi_ps(sz, zero);
+            _MM_TRANSPOSE4_PS(px, py, pz, one);
+
+            float* m = &out[0][0][0];
+            _mm_storeu_ps(m + 0, _mm_movelh_ps(ab_lo, zero));
+            _mm_storeu_ps(m + 4, _mm_movelh_ps(cd_lo, zero));
+            _mm_storeu_ps(m + 8, _mm_movelh_ps(zero, z_lo));
+            _mm_storeu_ps(m + 12, px);
+
+            m = &out[1][0][0];
+            _mm_storeu_ps(m + 0, _mm_movehl_ps(zero, ab_lo));
+            _mm_storeu_ps(m + 4, _mm_movehl_ps(zero, cd_lo));
+            _mm_storeu_ps(m + 8, _mm_movehl_ps(z_lo, zero));
+            _mm_storeu_ps(m + 12, py);
+
+            m = &out[2][0][0];
+            _mm_storeu_ps(m + 0, _mm_movelh_ps(ab_hi, zero));
+            _mm_storeu_ps(m + 4, _mm_movelh_ps(cd_hi, zero));
+            _mm_storeu_ps(m + 8, _mm_movelh_ps(zero, z_hi));
+            _mm_storeu_ps(m + 12, pz);
+
+            m = &out[3][0][0];
+            _mm_storeu_ps(m + 0, _mm_movehl_ps(zero, ab_hi));
+            _mm_storeu_ps(m + 4, _mm_movehl_ps(zero, cd_hi));
+            _mm_storeu_ps(m + 8, _mm_movehl_ps(z_hi, zero));
+            _mm_storeu_ps(m + 12, one);
+        }
+
+        MOPE_TARGET("sse2")
+        void buildModelsSSE(const TransformArrays& in, size_t count, mat4f* out)
+        {
+            const __m128 sign = _mm_set1_ps(-0.f);
+            alignas(16) float c[4], s[4];
+
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                for (size_t k = 0; k < 4; ++k) {
+                    sinCos(in.rotation[i + k], c[k], s[k]);
+                }
+                __m128 cos = _mm_load_ps(c);
+                __m128 sin = _mm_load_ps(s);
+                __m128 sx = _mm_loadu_ps(in.sx + i);
+                __m128 sy = _mm_loadu_ps(in.sy + i);
+
+                storeModels4(
+                    _mm_mul_ps(cos, sx),
+                    _mm_mul_ps(sin, sx),
+                    _mm_mul_ps(_mm_xor_ps(sin, sign), sy),
+                    _mm_mul_ps(cos, sy),
+                    _mm_loadu_ps(in.sz + i),
+                    _mm_loadu_ps(in.px + i),
+                    _mm_loadu_ps(in.py + i),
+                    _mm_loadu_ps(in.pz + i),
+                    out + i
+                );
+            }
+            buildModelsScalar(in.offset(i), count - i, out + i);
+        }
+
+        MOPE_TARGET("avx2")
+        void buildModelsAVX2(const TransformArrays& in, size_t count, mat4f* out)
+        {
+            const __m256 sign = _mm256_set1_ps(-0.f);
+            alignas(32) float c[8], s[8];
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                for (size_t k = 0; k < 8; ++k) {
+                    sinCos(in.rotation[i + k], c[k], s[k]);
+                }
+                __m256 cos = _mm256_load_ps(c);
+                __m256 sin = _mm256_load_ps(s);
+                __m256 sx = _mm256_loadu_ps(in.sx + i);
+                __m256 sy = _mm256_loadu_ps(in.sy + i);
+
+                __m256 a = _mm256_mul_ps(cos, sx);
+                __m256 b = _mm256_mul_ps(sin, sx);
+                __m256 c = _mm256_mul_ps(_mm256_xor_ps(sin, sign), sy);
+                __m256 d = _mm256_mul_ps(cos, sy);
+                __m256 sz = _mm256_loadu_ps(in.sz + i);
+                __m256 px = _mm256_loadu_ps(in.px + i);
+                __m256 py = _mm256_loadu_ps(in.py + i);
+                __m256 pz = _mm256_loadu_ps(in.pz + i);
+
+                storeModels4(
+                    _mm256_castps256_ps128(a), _mm256_castps256_ps128(b),
+                    _mm256_castps256_ps128(c), _mm256_castps256_ps128(d),
+                    _mm256_castps256_ps128(sz), _mm256_castps256_ps128(px),
+                    _mm256_castps256_ps128(py), _mm256_castps256_ps128(pz),
+                    out + i
+                );
+                storeModels4(
+                    _mm256_extractf128_ps(a, 1), _mm256_extractf128_ps(b, 1),
+                    _mm256_extractf128_ps(c, 1), _mm256_extractf128_ps(d, 1),
+                    _mm256_extractf128_ps(sz, 1), _mm256_extractf128_ps(px, 1),
+                    _mm256_extractf128_ps(py, 1), _mm256_extractf128_ps(pz, 1),
+                    out + i + 4
+                );
+            }
+            buildModelsSSE(in.offset(i), count - i, out + i);
+        }
+#endif
+
+        void buildModels(const TransformArrays& in, size_t count, mat4f* out, simd::Level level)
+        {
+            switch (level) {
+#if defined MOPE_ILLUSTRATOR_X86
+            case simd::Level::AVX2:
+                buildModelsAVX2(in, count, out);
+                break;
+            case simd::Level::SSE:
+                buildModelsSSE(in, count, out);
+                break;
+#endif
+            default:
+                buildModelsScalar(in, count, out);
+                break;
+            }
+        }
+
+        std::atomic<simd::Level> activeLevel{ simd::Detect() };
+    }
+
+    namespace simd
+    {
+        Level Detect()
+        {
+#if defined MOPE_ILLUSTRATOR_X86 && defined _MSC_VER
+            int regs[4];
+            __cpuid(regs, 1);
+            // leaf 7 below overwrites regs, so keep what we need from leaf 1
+            bool sse2 = regs[3] & (1 << 26);
+            bool osxsave = regs[2] & (1 << 27);
+            bool avx = regs[2] & (1 << 28);
+            if (osxsave && avx && (_xgetbv(0) & 6) == 6) {
+                __cpuidex(regs, 7, 0);
+                if (regs[1] & (1 << 5)) {
+                    return Level::AVX2;
+                }
+            }
+            return sse2 ? Level::SSE : Level::Scalar;
+#elif defined MOPE_ILLUSTRATOR_X86
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? Level::AVX2
+                : __builtin_cpu_supports("sse2") ? Level::SSE
+                : Level::Scalar;
+#else
+            return Level::Scalar;
+#endif
+        }
+
+        Level Active()
+        {
+            return activeLevel;
+        }
+
+        void SetActive(Level level)
+        {
+            activeLevel = std::min(level, Detect());
+        }
+
+        const char* Name(Level level)
+        {
+            switch (level) {
+            case Level::AVX2: return "AVX2";
+            case Level::SSE: return "SSE";
+            default: return "Scalar";
+            }
+        }
+    }
+
+    void BuildModels(const TransformArrays& in, size_t count, mat4f* out)
+    {
+        BuildModels(in, count, out, simd::Active());
+    }
+
+    void BuildModels(const TransformArrays& in, size_t count, mat4f* out, simd::Level level)
+    {
+        level = std::min(level, simd::Detect());
+
+        if (count < settings::transformParallelThreshold) {
+            buildModels(in, count, out, level);
+            return;
+        }
+
+        ThreadPool::Shared().ParallelFor(count, settings::transformBatchGrain,
+            [&](size_t begin, size_t end) {
+                buildModels(in.offset(begin), end - begin, out + begin, level);
+            });
+    }
+
+
+    /*========================================================================*\
+    |  Shader                                                                  |
+    \*========================================================================*/
+
+    Shader::Shader()
+        : SharedBindableObject(
+            [](GLuint* p_id) {
+                glDeleteProgram(*p_id);
+                if (gl::Bound().program == *p_id) {
+                    gl::Bound().program = 0;
+                }
+                delete p_id;
+            })
+    { }
+
+    void Shader::Make(std::string_view srcVertex, std::string_view srcFragment)
+    {
+        GLuint shader_vert = compile(srcVertex, GL_VERTEX_SHADER);
+        checkErrors(shader_vert);
+
+        GLuint shader_frag = compile(srcFragment, GL_FRAGMENT_SHADER);
+        checkErrors(shader_frag);
+
+        GLuint id = ID();
+        glAttachShader(id, shader_vert);
+        glAttachShader(id, shader_frag);
         glLinkProgram(id);
         checkErrors(id, true);
 
@@ -1141,6 +3780,11 @@ namespace mope
         glUseProgram(id);
     }
 
+    GLuint* Shader::boundSlot()
+    {
+        return &gl::Bound().program;
+    }
+
 
     /*========================================================================*\
     |  Texture                                                                 |
@@ -1150,6 +3794,9 @@ namespace mope
         : SharedBindableObject(
             [](GLuint* p_id) {
                 glDeleteTextures(1, p_id);
+                if (gl::Bound().texture2D == *p_id) {
+                    gl::Bound().texture2D = 0;
+                }
                 delete p_id;
             })
     { }
@@ -1164,6 +3811,11 @@ namespace mope
         glBindTexture(GL_TEXTURE_2D, id);
     }
 
+    GLuint* Texture2D::boundSlot()
+    {
+        return &gl::Bound().texture2D;
+    }
+
     void Texture2D::Make(std::string_view filename)
     {
         // This only has to be done once but it just sets a variable
@@ -1177,7 +3829,7 @@ namespace mope
             nChannels == 2 ? GL_RG :
             nChannels == 3 ? GL_RGB :
             nChannels == 4 ? GL_RGBA :
-            (throw std::exception("Problem loading image."), 0);
+            (throw std::runtime_error("Problem loading image."), 0);
 
         Make(width, height, (void*)data, fmt, GL_UNSIGNED_BYTE);
 
@@ -1225,6 +3877,9 @@ namespace mope
         : UniqueBindableObject(
             [](GLuint* p_id) {
                 glDeleteVertexArrays(1, p_id);
+                if (gl::Bound().vertexArray == *p_id) {
+                    gl::Bound().vertexArray = 0;
+                }
                 delete p_id;
             })
     { }
@@ -1239,10 +3894,16 @@ namespace mope
         glBindVertexArray(id);
     }
 
+    GLuint* VAO::boundSlot()
+    {
+        return &gl::Bound().vertexArray;
+    }
+
     BufferObject::BufferObject()
         : UniqueBindableObject(
             [](GLuint* p_id) {
                 glDeleteBuffers(1, p_id);
+                gl::ForgetBuffer(*p_id);
                 delete p_id;
             }
         )
@@ -1258,9 +3919,28 @@ namespace mope
         glBindBuffer(target(), id);
     }
 
+    GLuint* BufferObject::boundSlot()
+    {
+        return gl::Bound().buffer(target());
+    }
+
+    void BufferObject::bindTarget()
+    {
+        GLuint id = ID();
+        GLuint* bound = gl::Bound().buffer(target());
+        if (bound && *bound == id) {
+            return;
+        }
+        glBindBuffer(target(), id);
+        ++gl::Bound().changes;
+        if (bound) {
+            *bound = id;
+        }
+    }
+
     void BufferObject::Fill(const void* data, size_t size, size_t offset)
     {
-        Bind();
+        bindTarget();
         if (!m_allocated) {
             assert(offset == 0);
             glBufferData(target(), size, data, usage());
@@ -1273,7 +3953,7 @@ namespace mope
 
     void BufferObject::Resize(size_t size)
     {
-        Bind();
+        bindTarget();
         glBufferData(target(), size, nullptr, usage());
         m_allocated = true;
     }
@@ -1285,305 +3965,3683 @@ namespace mope
     GLenum SSBO::target() { return GL_SHADER_STORAGE_BUFFER; }
     GLenum SSBO::usage() { return GL_DYNAMIC_DRAW; }
 
-    void SSBO::bind(GLuint id)
+    SSBO::SSBO(GLuint index)
+        : m_index{ index }
     {
-        glBindBufferBase(target(), 0, id);
+        assert(index < settings::storageBindings);
     }
 
+    void SSBO::bind(GLuint id)
+    {
+        // this binds the plain target as well
+        glBindBufferBase(target(), m_index, id);
+        gl::Bound().storageBuffer = id;
+    }
 
-    /*========================================================================*\
-    |  Sprite                                                                  |
-    \*========================================================================*/
-
-    Instance::Instance(vec3f position, vec3f scale, float rotation)
-        : Instance(Data{ std::move(position), std::move(scale), std::move(rotation) })
-    { }
-
-    Instance::Instance(Data data)
-        : m_data{ std::move(data) }
-    { }
-
-    vec3f Instance::Position() const { return m_data.position; }
-    vec3f Instance::Scale() const { return m_data.scale; }
-    float Instance::Rotation() const { return m_data.rotation; }
-
-    void Instance::MoveTo(vec3f position)
+    GLuint* SSBO::boundSlot()
     {
-        m_data.position = std::move(position);
-        m_recompute = true;
+        return &gl::Bound().storageBuffers[m_index];
     }
 
-    void Instance::Move(const vec3f& direction)
+    namespace
     {
-        m_data.position += direction;
-        m_recompute = true;
+        // Replace `ranges` with the one range covering them all, once there
+        // are more than settings::dirtyRangeLimit
+        void limitRanges(std::vector<IndexRange>& ranges)
+        {
+            if (ranges.size() <= settings::dirtyRangeLimit) {
+                return;
+            }
+            IndexRange span = ranges.front();
+            for (const IndexRange& range : ranges) {
+                span.begin = std::min(span.begin, range.begin);
+                span.end = std::max(span.end, range.end);
+            }
+            ranges.assign(1, span);
+        }
     }
 
-    void Instance::SetScale(vec3f factors)
+    SSBORing::SSBORing(GLuint index)
+        : m_index{ index }
+        , m_fallback{ index }
+    { }
+
+    SSBORing::~SSBORing()
     {
-        m_data.scale = std::move(factors);
-        m_recompute = true;
+        release();
     }
 
-    void Instance::ScaleBy(const vec3f& factors)
+    size_t SSBORing::segments() const
     {
-        m_data.scale.scaleby(factors);
-        m_recompute = true;
+        return m_mapped ? settings::ssboRingSegments : 1;
     }
 
-    const mat4f* Instance::Model()
+    void SSBORing::Upload(const void* data, size_t count, size_t stride, const std::vector<IndexRange>& changed)
     {
-        if (m_recompute) {
-            mat4f translation = gl::translation(m_data.position);
-            mat4f scale = gl::scale(m_data.scale);
-            m_model = translation * scale;
-            m_recompute = false;
+        size_t size = count * stride;
+        if (size > m_segmentSize) {
+            grow(size);
         }
 
-        return &m_model;
-    }
+        // every segment has to catch up on this frame's changes eventually
+        for (size_t i = 0; i < segments(); ++i) {
+            Segment& segment = m_segments[i];
+            if (segment.stale) {
+                continue;
+            }
+            segment.pending.insert(segment.pending.end(), changed.begin(), changed.end());
+            limitRanges(segment.pending);
+        }
 
-    Sprite::Sprite(Shader shader)
-        : m_shader{ shader }
-    { }
+        Segment& segment = m_segments[m_current];
+        wait(segment);
 
-    Sprite::Sprite(Shader shader, Texture2D texture)
-        : m_shader{ shader }
-        , m_texture{ texture }
-    { }
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        size_t base = m_current * m_segmentSize;
+        auto write = [&](size_t offset, size_t length) {
+            if (m_mapped) {
+                std::memcpy(m_mapped + base + offset, src + offset, length);
+            }
+            else {
+                m_fallback.Fill(src + offset, length, offset);
+            }
+        };
 
-    Sprite::Sprite(Shader shader, Texture2D texture, vec2f left_bottom, vec2f right_top)
-        : m_shader{ shader }
-        , m_texture{ texture }
-        , m_leftBottom{ left_bottom }
-        , m_rightTop{ right_top }
-    { }
+        if (segment.stale) {
+            write(0, size);
+        }
+        else {
+            // coalesce the ranges, dropping whatever lies past the current count
+            auto& pending = segment.pending;
+            std::sort(pending.begin(), pending.end(),
+                [](const IndexRange& a, const IndexRange& b) { return a.begin < b.begin; });
+
+            size_t begin = 0, end = 0;
+            for (const IndexRange& range : pending) {
+                if (range.begin > end) {
+                    if (end > begin) {
+                        write(begin * stride, (end - begin) * stride);
+                    }
+                    begin = range.begin;
+                }
+                end = std::min(std::max(end, range.end), count);
+            }
+            if (end > begin) {
+                write(begin * stride, (end - begin) * stride);
+            }
+        }
+        segment.pending.clear();
+        segment.stale = false;
+
+        if (m_mapped) {
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, m_index, m_id, base, m_segmentSize);
+            gl::Bound().storageBuffer = m_id;
+            gl::Bound().storageBuffers[m_index] = m_id;
+            ++gl::Bound().changes;
+        }
+        else {
+            m_fallback.Bind();
+        }
+    }
 
-    void Sprite::Render()
+    void SSBORing::Fence()
     {
-        if (!m_prepared) {
-            prepare();
+        if (!m_mapped) {
+            return;
         }
-        
-        m_shader.Bind();
-        m_texture.Bind();
-        m_vao.Bind();
 
-        drawCall();
+        Segment& segment = m_segments[m_current];
+        if (segment.fence) {
+            glDeleteSync(segment.fence);
+        }
+        segment.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_current = (m_current + 1) % settings::ssboRingSegments;
     }
 
-    void Sprite::SetTexture(Texture2D tex)
+    void SSBORing::grow(size_t size)
     {
-        m_texture = tex;
-    }
-
-    void Sprite::SetTexture(vec2f left_bottom, vec2f right_top)
+        size_t new_size = m_segmentSize;
+        do {
+            new_size = new_size ? static_cast<size_t>(new_size * settings::ssboResizeFactor) : size;
+        } while (size > new_size);
+
+        constexpr size_t align = settings::ssboSegmentAlignment;
+        new_size = (new_size + align - 1) / align * align;
+
+        release();
+        m_segmentSize = new_size;
+
+        if (glBufferStorage) {
+            constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            const size_t total = m_segmentSize * settings::ssboRingSegments;
+
+            glGenBuffers(1, &m_id);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_id);
+            gl::Bound().storageBuffer = m_id;
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, total, nullptr, flags);
+            m_mapped = static_cast<uint8_t*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, total, flags));
+        }
+        if (!m_mapped) {
+            m_fallback.Resize(m_segmentSize);
+        }
+
+        for (Segment& segment : m_segments) {
+            segment.stale = true;
+            segment.pending.clear();
+        }
+    }
+
+    void SSBORing::release()
     {
-        m_leftBottom = left_bottom;
-        m_rightTop = right_top;
-        if (m_prepared) {
-            fillVertices();
+        GLsync fences[settings::ssboRingSegments]{ };
+        bool any = m_id != 0;
+        for (size_t i = 0; i < settings::ssboRingSegments; ++i) {
+            fences[i] = std::exchange(m_segments[i].fence, nullptr);
+            any = any || fences[i];
+        }
+
+        // the last owner may be on any thread, so the names go where the
+        // context lives, as with gl::Deleter
+        if (any) {
+            gl::Post([id = m_id, mapped = m_mapped != nullptr, fences] {
+                for (GLsync fence : fences) {
+                    if (fence) {
+                        glDeleteSync(fence);
+                    }
+                }
+                if (id) {
+                    GLuint name = id;
+                    if (mapped) {
+                        glBindBuffer(GL_SHADER_STORAGE_BUFFER, name);
+                        gl::Bound().storageBuffer = name;
+                        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+                    }
+                    // deleting it unbinds it, so the cache has to hear of that too
+                    glDeleteBuffers(1, &name);
+                    gl::ForgetBuffer(name);
+                }
+            });
         }
+        m_id = 0;
+        m_mapped = nullptr;
+        m_current = 0;
     }
 
-    void Sprite::SetTexture(Texture2D tex, vec2f left_bottom, vec2f right_top)
+    void SSBORing::wait(Segment& segment)
     {
-        SetTexture(tex);
-        SetTexture(left_bottom, right_top);
+        if (!segment.fence) {
+            return;
+        }
+
+        // one millisecond at a time, until the GPU is done reading
+        constexpr GLuint64 timeout = 1000000;
+        while (glClientWaitSync(segment.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout) == GL_TIMEOUT_EXPIRED)
+        { }
+
+        glDeleteSync(segment.fence);
+        segment.fence = nullptr;
     }
 
-    void Sprite::prepare()
+
+    /*========================================================================*\
+    |  Culling                                                                 |
+    \*========================================================================*/
+
+    Bounds Bounds::OfQuad(const mat4f& model)
     {
-        // need to bind VBO before filling attribs (I think)
-        fillVertices();
-        fillAttribArray();
-        fillIndices();
-        m_prepared = true;
+        // the corners are the translation plus or minus half of each of the
+        // first two columns
+        vec3f half{
+            0.5f * (std::abs(model[0][0]) + std::abs(model[1][0])),
+            0.5f * (std::abs(model[0][1]) + std::abs(model[1][1])),
+            0.5f * (std::abs(model[0][2]) + std::abs(model[1][2]))
+        };
+        return {
+            { model[3][0] - half.x(), model[3][1] - half.y(), model[3][2] - half.z() },
+            { model[3][0] + half.x(), model[3][1] + half.y(), model[3][2] + half.z() } };
     }
 
-    void Sprite::fillVertices()
+    Frustum::Frustum(const mat4f& viewProjection)
+        : m_matrix{ viewProjection }
     {
-        float left = m_leftBottom.x(),
-            bottom = m_leftBottom.y(),
-            right = m_rightTop.x(),
-            top = m_rightTop.y();
-        const GLfloat vertices[] = {
-            -0.5f,  -0.5f,  left,   bottom,
-            0.5f,   -0.5f,  right,  bottom,
-            -0.5f,  0.5f,   left,   top,
-            0.5f,   0.5f,   right,  top
+        // each plane is the last row plus or minus one of the others
+        auto row = [&](size_t r) {
+            return vec4f{ viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r] };
         };
+        const vec4f w = row(3);
+        for (size_t axis = 0; axis < 3; ++axis) {
+            const vec4f r = row(axis);
+            m_planes[2 * axis] = { w.x() + r.x(), w.y() + r.y(), w.z() + r.z(), w.w() + r.w() };
+            m_planes[2 * axis + 1] = { w.x() - r.x(), w.y() - r.y(), w.z() - r.z(), w.w() - r.w() };
+        }
 
-        m_vbo.Fill(vertices, sizeof(vertices));
+        // the corners of clip space, carried back into the world
+        constexpr float inf = std::numeric_limits<float>::infinity();
+        m_extent = { { inf, inf, inf }, { -inf, -inf, -inf } };
+        const mat4f inv = gl::inverse(viewProjection);
+        for (int corner = 0; corner < 8; ++corner) {
+            const float ndc[4]{ corner & 1 ? 1.f : -1.f, corner & 2 ? 1.f : -1.f, corner & 4 ? 1.f : -1.f, 1.f };
+            float world[4]{ };
+            for (size_t r = 0; r < 4; ++r) {
+                for (size_t c = 0; c < 4; ++c) {
+                    world[r] += inv[c][r] * ndc[c];
+                }
+            }
+            for (size_t i = 0; i < 3; ++i) {
+                float value = world[i] / world[3];
+                if (!(world[3] > 0.f) || !std::isfinite(value)) {
+                    m_extent = { { -inf, -inf, -inf }, { inf, inf, inf } };
+                    return;
+                }
+                m_extent.min[i] = std::min(m_extent.min[i], value);
+                m_extent.max[i] = std::max(m_extent.max[i], value);
+            }
+        }
     }
 
-    void Sprite::fillIndices()
+    bool Frustum::Intersects(const Bounds& bounds) const
     {
-        const GLubyte indices[4] = { 0, 1, 2, 3 };
-        m_ebo.Fill(indices, sizeof(indices));
+        // outside if even the corner farthest along the plane's normal is behind it
+        for (const vec4f& plane : m_planes) {
+            float x = plane.x() >= 0.f ? bounds.max.x() : bounds.min.x();
+            float y = plane.y() >= 0.f ? bounds.max.y() : bounds.min.y();
+            float z = plane.z() >= 0.f ? bounds.max.z() : bounds.min.z();
+            if (plane.x() * x + plane.y() * y + plane.z() * z + plane.w() < 0.f) {
+                return false;
+            }
+        }
+        return true;
     }
 
-    void Sprite::fillAttribArray()
+    const Bounds& Frustum::Extent() const
     {
-        m_vao.Bind();
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat[4]), (void*)0);
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat[4]), (void*)(sizeof(GLfloat[2])));
+        return m_extent;
     }
 
-    BasicSprite::BasicSprite(
-        Data data,
-        Shader shader,
-        Texture2D texture,
-        vec2f leftBottom,
-        vec2f rightTop
-    )
-        : Sprite{ shader, texture, leftBottom, rightTop }
-        , Instance{ data }
-    { }
+    float Frustum::Depth(const vec3f& point) const
+    {
+        const mat4f& m = m_matrix;
+        float z = m[0][2] * point.x() + m[1][2] * point.y() + m[2][2] * point.z() + m[3][2];
+        float w = m[0][3] * point.x() + m[1][3] * point.y() + m[2][3] * point.z() + m[3][3];
+        return z / w;
+    }
 
-    void BasicSprite::drawCall()
+    SpatialGrid::SpatialGrid(float cellSize)
+        : m_cellSize{ cellSize }
     {
-        m_ssbo.Bind();
+        assert(cellSize > 0.f);
+    }
 
-        const mat4f* model = Model();
-        m_ssbo.Fill(model, sizeof(*model));
+    void SpatialGrid::Insert(uint32_t id, const Bounds& bounds)
+    {
+        if (id >= m_items.size()) {
+            m_items.resize(id + size_t{ 1 });
+        }
 
-        glDrawElements(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_BYTE, (void*)0); 
+        float cx = 0.5f * (bounds.min.x() + bounds.max.x());
+        float cy = 0.5f * (bounds.min.y() + bounds.max.y());
+        int64_t key = cellKey(cellCoord(cx), cellCoord(cy));
+
+        Item& item = m_items[id];
+        const float reach = std::max(bounds.max.x() - cx, bounds.max.y() - cy);
+
+        // the new reach goes in first, so the margin never has to search down
+        // past it
+        addReach(reach);
+        if (item.live) {
+            dropReach(item.reach);
+        }
+        if (item.live && item.cell != key) {
+            detach(id);
+        }
+        if (!item.live) {
+            std::vector<uint32_t>& cell = m_cells[key];
+            item.cell = key;
+            item.slot = static_cast<uint32_t>(cell.size());
+            item.live = true;
+            cell.push_back(id);
+            ++m_size;
+        }
+        item.bounds = bounds;
+        item.reach = reach;
     }
 
-    void InstancedSprite::AddInstance(std::shared_ptr<Instance> instance)
+    bool SpatialGrid::Remove(uint32_t id)
     {
-        m_instances.push_back(instance);
+        if (!Contains(id)) {
+            return false;
+        }
+        dropReach(m_items[id].reach);
+        detach(id);
+        return true;
     }
 
-    std::shared_ptr<Instance> InstancedSprite::MakeInstance(vec3f position, vec3f scale, float rotation)
+    bool SpatialGrid::Contains(uint32_t id) const
     {
-        return MakeInstance({ position, scale, rotation });
+        return id < m_items.size() && m_items[id].live;
     }
 
-    std::shared_ptr<Instance> InstancedSprite::MakeInstance(Instance::Data data)
+    void SpatialGrid::Clear()
     {
-        std::shared_ptr<Instance> instance = std::make_shared<Instance>(data);
-        AddInstance(instance);
-        return instance;
+        m_cells.clear();
+        m_items.clear();
+        m_size = 0;
+        m_margin = 0.f;
+        std::fill(std::begin(m_reaches), std::end(m_reaches), 0u);
+        m_topReach = 0;
     }
 
-    void InstancedSprite::drawCall()
+    size_t SpatialGrid::Size() const
     {
-        auto sub_data = std::make_unique<mat4f[]>(m_instances.size());
+        return m_size;
+    }
 
-        // copy all model matrices into sub_data, at the same time removing expired instances
-        auto prev_end{ m_instances.end() };
-        auto new_end{ prev_end };
-        for (auto iter = m_instances.begin(); iter != prev_end; ++iter)
-        {
-            if (auto p_instance = iter->lock())
-            {
-                std::memcpy(
-                    &sub_data[std::distance(m_instances.begin(), iter)],
-                    p_instance->Model(),
-                    sizeof(*p_instance->Model())
-                );
+    template <class Test>
+    void SpatialGrid::query(const Bounds& region, Test&& test, std::vector<uint32_t>& out) const
+    {
+        if (!m_size) {
+            return;
+        }
+
+        const int x0 = cellCoord(region.min.x() - m_margin);
+        const int x1 = cellCoord(region.max.x() + m_margin);
+        const int y0 = cellCoord(region.min.y() - m_margin);
+        const int y1 = cellCoord(region.max.y() + m_margin);
+
+        auto visit = [&](const std::vector<uint32_t>& cell) {
+            for (uint32_t id : cell) {
+                if (test(m_items[id].bounds)) {
+                    out.push_back(id);
+                }
+            }
+        };
 
-                if (new_end != prev_end) {
-                    *new_end++ = std::move(*iter);
+        // walk whichever is smaller: the covered cells or the occupied ones
+        const double span = (double(x1) - x0 + 1) * (double(y1) - y0 + 1);
+        if (span > double(m_cells.size())) {
+            for (const auto& [key, cell] : m_cells) {
+                int x = int32_t(uint64_t(key) >> 32);
+                int y = int32_t(uint32_t(key));
+                if (x >= x0 && x <= x1 && y >= y0 && y <= y1) {
+                    visit(cell);
                 }
             }
-            else if (new_end == prev_end) {
-                new_end = iter;
+        }
+        else {
+            for (int x = x0; x <= x1; ++x) {
+                for (int y = y0; y <= y1; ++y) {
+                    auto found = m_cells.find(cellKey(x, y));
+                    if (found != m_cells.end()) {
+                        visit(found->second);
+                    }
+                }
             }
         }
-        m_instances.erase(new_end, prev_end);
+    }
 
-        // resize the shader storage buffer if necessary
-        if (m_instances.size() > m_bufferSize)
-        {
-            do {
-                m_bufferSize = m_bufferSize ? static_cast<size_t>(m_bufferSize * settings::ssboResizeFactor) : 1;
-            } while (m_instances.size() > m_bufferSize);
-            m_ssbo.Resize(sizeof(mat4f) * m_bufferSize);
+    void SpatialGrid::Query(const Bounds& region, std::vector<uint32_t>& out) const
+    {
+        query(region, [&](const Bounds& bounds) {
+            return bounds.min.x() <= region.max.x() && region.min.x() <= bounds.max.x()
+                && bounds.min.y() <= region.max.y() && region.min.y() <= bounds.max.y();
+        }, out);
+    }
+
+    void SpatialGrid::Query(vec2f point, std::vector<uint32_t>& out) const
+    {
+        Query(Bounds{ { point.x(), point.y(), 0.f }, { point.x(), point.y(), 0.f } }, out);
+    }
+
+    void SpatialGrid::Query(const Frustum& frustum, std::vector<uint32_t>& out) const
+    {
+        query(frustum.Extent(), [&](const Bounds& bounds) { return frustum.Intersects(bounds); }, out);
+    }
+
+    int SpatialGrid::cellCoord(float position) const
+    {
+        // clamped, so that unbounded queries still make sensible ranges
+        constexpr double limit = 1 << 30;
+        return static_cast<int>(std::clamp(std::floor(double(position) / m_cellSize), -limit, limit));
+    }
+
+    int64_t SpatialGrid::cellKey(int x, int y) const
+    {
+        return int64_t(uint64_t(uint32_t(x)) << 32 | uint32_t(y));
+    }
+
+    void SpatialGrid::detach(uint32_t id)
+    {
+        Item& item = m_items[id];
+        auto found = m_cells.find(item.cell);
+        std::vector<uint32_t>& cell = found->second;
+
+        uint32_t moved = cell.back();
+        cell[item.slot] = moved;
+        m_items[moved].slot = item.slot;
+        cell.pop_back();
+        if (cell.empty()) {
+            m_cells.erase(found);
         }
 
-        // fill the shader storage buffer and draw
-        m_ssbo.Fill(sub_data.get(), sizeof(mat4f) * m_instances.size());
+        item.live = false;
+        --m_size;
+    }
 
-        glDrawElementsInstanced(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_BYTE, (void*)0, m_instances.size());
+    uint32_t SpatialGrid::reachBucket(float reach)
+    {
+        // the exponent and top two mantissa bits of a non-negative float
+        uint32_t bits;
+        reach = reach > 0.f ? reach : 0.f;
+        std::memcpy(&bits, &reach, sizeof(bits));
+        return std::min(bits >> 21, reachBuckets - 1);
     }
 
-    AnimatedSprite::AnimatedSprite(Data data, Shader shader)
-        : BasicSprite(data, shader)
-    { }
+    float SpatialGrid::bucketTop(uint32_t bucket)
+    {
+        // the least float in the next bucket up, past every reach in this one
+        uint32_t bits = (bucket + 1) << 21;
+        if (bits >= 0x7F800000u) {
+            return std::numeric_limits<float>::infinity();
+        }
+        float top;
+        std::memcpy(&top, &bits, sizeof(top));
+        return top;
+    }
 
-    void AnimatedSprite::AddFrame(Frame frame)
+    void SpatialGrid::addReach(float reach)
     {
-        m_frames.push_back(std::move(frame));
+        uint32_t bucket = reachBucket(reach);
+        ++m_reaches[bucket];
+        if (bucket >= m_topReach) {
+            m_topReach = bucket + 1;
+            m_margin = bucketTop(bucket);
+        }
     }
 
-    void AnimatedSprite::SetAll(std::vector<Frame> frames)
+    void SpatialGrid::dropReach(float reach)
     {
-        m_frames = frames;
+        --m_reaches[reachBucket(reach)];
+        while (m_topReach && !m_reaches[m_topReach - 1]) {
+            --m_topReach;
+        }
+        m_margin = m_topReach ? bucketTop(m_topReach - 1) : 0.f;
     }
 
-    void AnimatedSprite::DropFrame(size_t idx)
+
+    /*========================================================================*\
+    |  Texture manager                                                         |
+    \*========================================================================*/
+
+    namespace
     {
-        m_frames.erase(m_frames.begin() + idx);
+        uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+        {
+            auto bytes = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < size; ++i) {
+                hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+            }
+            return hash;
+        }
+
+        // Whether a load has finished, with an exception
+        bool failed(const std::shared_future<Texture2D>& texture)
+        {
+            if (texture.wait_for(std::chrono::seconds{ 0 }) != std::future_status::ready) {
+                return false;
+            }
+            try {
+                texture.get();
+                return false;
+            }
+            catch (...) {
+                return true;
+            }
+        }
+
+        // Read-only mapping of a whole file; empty if it couldn't be mapped
+        class MappedFile
+        {
+        public:
+            explicit MappedFile(const std::string& filename)
+            {
+#if defined _WIN32
+                m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                LARGE_INTEGER size;
+                if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+                    return;
+                }
+                m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (m_mapping) {
+                    m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+                    m_size = m_data ? static_cast<size_t>(size.QuadPart) : 0;
+                }
+#else
+                int fd = open(filename.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    return;
+                }
+                struct stat info;
+                if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (data != MAP_FAILED) {
+                        m_data = static_cast<const uint8_t*>(data);
+                        m_size = static_cast<size_t>(info.st_size);
+                    }
+                }
+                close(fd);
+#endif
+            }
+
+            ~MappedFile()
+            {
+#if defined _WIN32
+                if (m_data) {
+                    UnmapViewOfFile(m_data);
+                }
+                if (m_mapping) {
+                    CloseHandle(m_mapping);
+                }
+                if (m_file != INVALID_HANDLE_VALUE) {
+                    CloseHandle(m_file);
+                }
+#else
+                if (m_data) {
+                    munmap(const_cast<uint8_t*>(m_data), m_size);
+                }
+#endif
+            }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            const uint8_t* Data() const { return m_data; }
+            size_t Size() const { return m_size; }
+
+        private:
+            const uint8_t* m_data{ nullptr };
+            size_t m_size{ 0 };
+#if defined _WIN32
+            HANDLE m_file{ INVALID_HANDLE_VALUE };
+            HANDLE m_mapping{ nullptr };
+#endif
+        };
+
+        // Atlas cache files are a header, the region records, their names packed
+        // end to end, then the RGBA pages. Pages start on a page boundary so they
+        // go to OpenGL straight out of the mapping.
+        struct AtlasFileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t pageCount;
+            uint32_t pageWidth;
+            uint32_t pageHeight;
+            uint64_t sourceHash;
+            uint32_t regionCount;
+            uint32_t namesSize;
+            uint64_t pagesOffset;
+        };
+        static_assert(sizeof(AtlasFileHeader) == 48);
+
+        struct AtlasFileRegion
+        {
+            uint32_t page;
+            uint32_t nameOffset;
+            uint32_t nameLength;
+            float rect[4];
+        };
+
+        constexpr char atlasMagic[8] = "MOPEATL";
+        constexpr uint32_t atlasVersion = 1;
+        constexpr size_t atlasFileAlignment = 4096;
     }
 
-    void AnimatedSprite::DropAll()
+    const AtlasRegion& Atlas::Region(const std::string& filename) const
     {
-        m_frames.clear();
+        return regions.at(filename);
     }
 
-    void AnimatedSprite::Next()
+    Texture2D& Atlas::Page(const AtlasRegion& region)
     {
-        nextFrame();
-        updateTexture();
+        return pages.at(region.page);
     }
 
-    void AnimatedSprite::SwitchTo(size_t idx, bool ignore_elapsed)
+    SkylinePacker::SkylinePacker(int width, int height)
+        : m_width{ width }
+        , m_height{ height }
+        , m_skyline{ { 0, 0, width } }
+    { }
+
+    bool SkylinePacker::Pack(int width, int height, int& x, int& y)
     {
-        m_currentFrame = idx;
-        m_ignoreElapsed = ignore_elapsed;
-        updateTexture();
+        // Rest it as low as possible, preferring the narrowest segment on ties
+        size_t best = m_skyline.size();
+        int bestY = 0;
+        for (size_t i = 0; i < m_skyline.size(); ++i) {
+            int top = fit(i, width, height);
+            if (top < 0) {
+                continue;
+            }
+            if (best == m_skyline.size() || top < bestY
+                || (top == bestY && m_skyline[i].width < m_skyline[best].width))
+            {
+                best = i;
+                bestY = top;
+            }
+        }
+        if (best == m_skyline.size()) {
+            return false;
+        }
+
+        x = m_skyline[best].x;
+        y = bestY;
+
+        // The top of the new rectangle swallows whatever segments it covers
+        m_skyline.insert(m_skyline.begin() + best, { x, y + height, width });
+        for (size_t i = best + 1; i < m_skyline.size();) {
+            Segment& segment = m_skyline[i];
+            int overlap = x + width - segment.x;
+            if (overlap <= 0) {
+                break;
+            }
+            if (overlap < segment.width) {
+                segment.x += overlap;
+                segment.width -= overlap;
+                break;
+            }
+            m_skyline.erase(m_skyline.begin() + i);
+        }
+
+        for (size_t i = 0; i + 1 < m_skyline.size();) {
+            if (m_skyline[i].y == m_skyline[i + 1].y) {
+                m_skyline[i].width += m_skyline[i + 1].width;
+                m_skyline.erase(m_skyline.begin() + i + 1);
+            }
+            else {
+                ++i;
+            }
+        }
+        return true;
     }
 
-    void AnimatedSprite::Render(double elapsed)
+    int SkylinePacker::fit(size_t i, int width, int height) const
     {
-        if (!m_ignoreElapsed) {
-            m_currentFrameTime += elapsed;
+        if (m_skyline[i].x + width > m_width) {
+            return -1;
         }
-        m_ignoreElapsed = false;
 
-        bool updated = false;
-        while (m_currentFrameTime > m_frames[m_currentFrame].time) {
-            m_currentFrameTime -= m_frames[m_currentFrame].time;
-            nextFrame();
-            updated = true;
+        // segments run edge to edge, so this can't walk off the end
+        int y = 0;
+        for (int remaining = width; remaining > 0; ++i) {
+            y = std::max(y, m_skyline[i].y);
+            if (y + height > m_height) {
+                return -1;
+            }
+            remaining -= m_skyline[i].width;
         }
-        if (updated) {
-            updateTexture();
+        return y;
+    }
+
+    TextureManager::TextureManager(size_t threads)
+        : m_threads{ std::max(threads, size_t{ 1 }) }
+    {
+        // global to stb_image, so set it before any worker decodes
+        stbi_set_flip_vertically_on_load(true);
+    }
+
+    std::shared_future<Texture2D> TextureManager::Load(const std::string& filename)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        auto found = m_byPath.find(filename);
+        if (found != m_byPath.end()) {
+            if (!failed(found->second)) {
+                return found->second;
+            }
+            // let the caller retry, perhaps after fixing the file
+            m_byPath.erase(found);
         }
 
-        BasicSprite::Render();
+        auto promise = std::make_shared<std::promise<Texture2D>>();
+        std::shared_future<Texture2D> future = promise->get_future().share();
+        m_byPath.emplace(filename, future);
+        workers().Enqueue([this, filename, promise, future] {
+            loadTexture(filename, promise, future);
+        });
+        return future;
     }
 
-    void AnimatedSprite::nextFrame()
+    std::shared_future<Atlas> TextureManager::LoadAtlas(const std::vector<std::string>& filenames, const std::string& cacheFile)
     {
-        if (++m_currentFrame >= m_frames.size())
-        {
-            m_currentFrame = 0;
+        // each name only gets packed once
+        std::vector<std::string> unique{ };
+        for (const std::string& filename : filenames) {
+            if (std::find(unique.begin(), unique.end(), filename) == unique.end()) {
+                unique.push_back(filename);
+            }
+        }
+
+        auto promise = std::make_shared<std::promise<Atlas>>();
+        std::shared_future<Atlas> future = promise->get_future().share();
+        workers().Enqueue([this, unique = std::move(unique), cacheFile, promise] {
+            loadAtlas(unique, cacheFile, promise);
+        });
+        return future;
+    }
+
+    Texture2D TextureManager::Get(const std::shared_future<Texture2D>& texture)
+    {
+        if (texture.valid() && texture.wait_for(std::chrono::seconds{ 0 }) == std::future_status::ready) {
+            try {
+                return texture.get();
+            }
+            catch (const std::exception&) {
+                // the failure is still there for whoever holds the future
+            }
         }
+        return Placeholder();
     }
 
-    void AnimatedSprite::updateTexture()
+    Texture2D TextureManager::Placeholder()
     {
-        m_texture = m_frames[m_currentFrame].texture;
-        m_leftBottom = m_frames[m_currentFrame].leftBottom;
-        m_rightTop = m_frames[m_currentFrame].rightTop;
-        fillVertices();
+        if (!m_hasPlaceholder) {
+            Pixel clear{ 0, 0, 0, 0 };
+            m_placeholder.Make(1, 1, &clear);
+            m_hasPlaceholder = true;
+        }
+        return m_placeholder;
     }
-}
+
+    void TextureManager::Update(double budget)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::chrono::duration<double> limit{ budget };
+
+        for (;;) {
+            std::function<void()> upload;
+            {
+                std::lock_guard<std::mutex> lock{ m_mutex };
+                if (m_uploads.empty()) {
+                    break;
+                }
+                upload = std::move(m_uploads.front());
+                m_uploads.pop_front();
+            }
+            upload();
+
+            if (std::chrono::steady_clock::now() - start >= limit) {
+                break;
+            }
+        }
+    }
+
+    size_t TextureManager::Pending()
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        return m_uploads.size();
+    }
+
+    std::vector<uint8_t> TextureManager::readFile(const std::string& filename)
+    {
+        std::ifstream file{ filename, std::ios::binary | std::ios::ate };
+        if (!file) {
+            throw std::runtime_error("Couldn't open image " + filename);
+        }
+
+        std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+        if (!file) {
+            throw std::runtime_error("Couldn't read image " + filename);
+        }
+        return bytes;
+    }
+
+    TextureManager::Image TextureManager::decode(const std::vector<uint8_t>& bytes, int channels, const std::string& filename)
+    {
+        Image image{ };
+        uint8_t* pixels = stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()),
+            &image.width, &image.height, &image.channels, channels);
+        if (!pixels) {
+            throw std::runtime_error("Problem loading image " + filename + ": " + stbi_failure_reason());
+        }
+
+        if (channels) {
+            image.channels = channels;
+        }
+        image.pixels = std::shared_ptr<const uint8_t>(pixels, stbi_image_free);
+        return image;
+    }
+
+    Texture2D TextureManager::upload(const Image& image)
+    {
+        GLenum format =
+            image.channels == 1 ? GL_RED :
+            image.channels == 2 ? GL_RG :
+            image.channels == 3 ? GL_RGB :
+            GL_RGBA;
+
+        Texture2D texture{ };
+        texture.Make(image.width, image.height, const_cast<uint8_t*>(image.pixels.get()), format, GL_UNSIGNED_BYTE);
+        return texture;
+    }
+
+    uint64_t TextureManager::sourceHash(const std::vector<std::string>& filenames)
+    {
+        // the packing settings change the output too
+        int packing[2]{ settings::atlasPageSize, settings::atlasPadding };
+        uint64_t hash = fnv1a(packing, sizeof(packing));
+
+        for (const std::string& filename : filenames) {
+            hash = fnv1a(filename.c_str(), filename.size() + 1, hash);
+
+            std::error_code error;
+            uint64_t stamp[2]{
+                static_cast<uint64_t>(std::filesystem::file_size(filename, error)),
+                static_cast<uint64_t>(std::filesystem::last_write_time(filename, error).time_since_epoch().count())
+            };
+            hash = fnv1a(stamp, sizeof(stamp), hash);
+        }
+        return hash;
+    }
+
+    void TextureManager::writeAtlas(const std::string& cacheFile, uint64_t hash,
+        const std::vector<Image>& pages, const std::unordered_map<std::string, AtlasRegion>& regions)
+    {
+        std::vector<AtlasFileRegion> records{ };
+        std::string names{ };
+        for (const auto& [name, region] : regions) {
+            records.push_back({
+                static_cast<uint32_t>(region.page),
+                static_cast<uint32_t>(names.size()),
+                static_cast<uint32_t>(name.size()),
+                { region.leftBottom.x(), region.leftBottom.y(), region.rightTop.x(), region.rightTop.y() } });
+            names += name;
+        }
+
+        AtlasFileHeader header{ };
+        std::memcpy(header.magic, atlasMagic, sizeof(header.magic));
+        header.version = atlasVersion;
+        header.pageCount = static_cast<uint32_t>(pages.size());
+        header.pageWidth = pages.empty() ? 0 : pages.front().width;
+        header.pageHeight = pages.empty() ? 0 : pages.front().height;
+        header.sourceHash = hash;
+        header.regionCount = static_cast<uint32_t>(records.size());
+        header.namesSize = static_cast<uint32_t>(names.size());
+
+        size_t end = sizeof(header) + records.size() * sizeof(AtlasFileRegion) + names.size();
+        header.pagesOffset = (end + atlasFileAlignment - 1) / atlasFileAlignment * atlasFileAlignment;
+        std::vector<char> padding(header.pagesOffset - end, 0);
+
+        // written aside and renamed into place, so a reader never maps half a file
+        std::string temp = cacheFile + ".tmp";
+        bool written;
+        {
+            std::ofstream file{ temp, std::ios::binary | std::ios::trunc };
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(AtlasFileRegion));
+            file.write(names.data(), names.size());
+            file.write(padding.data(), padding.size());
+            for (const Image& page : pages) {
+                file.write(reinterpret_cast<const char*>(page.pixels.get()), size_t(page.width) * page.height * 4);
+            }
+            written = static_cast<bool>(file.flush());
+        }
+
+        // the cache is only an optimization, so failing to write it is fine
+        std::error_code error;
+        if (written) {
+            std::filesystem::rename(temp, cacheFile, error);
+        }
+        if (!written || error) {
+            std::filesystem::remove(temp, error);
+        }
+    }
+
+    void TextureManager::loadTexture(const std::string& filename, TexturePromise promise, std::shared_future<Texture2D> future)
+    {
+        try {
+            std::vector<uint8_t> bytes = readFile(filename);
+            uint64_t hash = fnv1a(bytes.data(), bytes.size());
+
+            // Same contents as something already loading: share its texture,
+            // once that's done. The original is settled under m_mutex, so it
+            // can't finish between checking it and joining its waiters.
+            std::shared_future<Texture2D> original;
+            {
+                std::lock_guard<std::mutex> lock{ m_mutex };
+                auto [found, added] = m_byHash.try_emplace(hash, future);
+                if (!added && failed(found->second)) {
+                    // try again rather than share the failure
+                    found->second = future;
+                }
+                else if (!added) {
+                    original = found->second;
+                    if (original.wait_for(std::chrono::seconds{ 0 }) != std::future_status::ready) {
+                        m_waiting[hash].push_back(promise);
+                        return;
+                    }
+                }
+            }
+            if (original.valid()) {
+                promise->set_value(original.get());
+                return;
+            }
+
+            try {
+                Image image = decode(bytes, 0, filename);
+                post([this, hash, image, promise] {
+                    try {
+                        settle(hash, promise, upload(image), nullptr);
+                    }
+                    catch (...) {
+                        settle(hash, promise, Texture2D{ }, std::current_exception());
+                    }
+                });
+            }
+            catch (...) {
+                settle(hash, promise, Texture2D{ }, std::current_exception());
+            }
+        }
+        catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    }
+
+    void TextureManager::settle(uint64_t hash, const TexturePromise& promise, const Texture2D& texture, std::exception_ptr error)
+    {
+        std::vector<TexturePromise> waiting{ };
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            if (error) {
+                promise->set_exception(error);
+            }
+            else {
+                promise->set_value(texture);
+            }
+
+            auto found = m_waiting.find(hash);
+            if (found != m_waiting.end()) {
+                waiting = std::move(found->second);
+                m_waiting.erase(found);
+            }
+        }
+
+        for (const TexturePromise& other : waiting) {
+            if (error) {
+                other->set_exception(error);
+            }
+            else {
+                other->set_value(texture);
+            }
+        }
+    }
+
+    void TextureManager::loadAtlas(const std::vector<std::string>& filenames, const std::string& cacheFile, AtlasPromise promise)
+    {
+        try {
+            uint64_t hash = sourceHash(filenames);
+            if (!cacheFile.empty() && readAtlas(cacheFile, hash, promise)) {
+                return;
+            }
+
+            std::vector<Image> images(filenames.size());
+            std::exception_ptr failure{ };
+            std::mutex failureMutex{ };
+            workers().ParallelFor(filenames.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    try {
+                        images[i] = decode(readFile(filenames[i]), 4, filenames[i]);
+                    }
+                    catch (...) {
+                        std::lock_guard<std::mutex> lock{ failureMutex };
+                        failure = failure ? failure : std::current_exception();
+                    }
+                }
+            });
+            if (failure) {
+                std::rethrow_exception(failure);
+            }
+
+            // tallest first packs tightest
+            std::vector<size_t> order(images.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                order[i] = i;
+            }
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return images[a].height > images[b].height;
+            });
+
+            const int size = settings::atlasPageSize;
+            const int padding = settings::atlasPadding;
+            const float scale = 1.f / size;
+
+            std::vector<SkylinePacker> packers{ };
+            std::vector<std::shared_ptr<uint8_t>> buffers{ };
+            std::unordered_map<std::string, AtlasRegion> regions{ };
+
+            for (size_t i : order) {
+                const Image& image = images[i];
+                int width = image.width + 2 * padding;
+                int height = image.height + 2 * padding;
+                if (width > size || height > size) {
+                    throw std::runtime_error(filenames[i] + " is too big for an atlas page");
+                }
+
+                size_t page = 0;
+                int x, y;
+                while (page < packers.size() && !packers[page].Pack(width, height, x, y)) {
+                    ++page;
+                }
+                if (page == packers.size()) {
+                    packers.emplace_back(size, size);
+                    buffers.emplace_back(new uint8_t[size_t(size) * size * 4](), std::default_delete<uint8_t[]>());
+                    packers.back().Pack(width, height, x, y);
+                }
+
+                x += padding;
+                y += padding;
+                size_t row = size_t(image.width) * 4;
+                for (int r = 0; r < image.height; ++r) {
+                    std::memcpy(buffers[page].get() + (size_t(y + r) * size + x) * 4, image.pixels.get() + r * row, row);
+                }
+
+                regions[filenames[i]] = {
+                    page,
+                    { x * scale, y * scale },
+                    { (x + image.width) * scale, (y + image.height) * scale } };
+            }
+
+            std::vector<Image> pages{ };
+            for (auto& buffer : buffers) {
+                pages.push_back({ size, size, 4, std::move(buffer) });
+            }
+
+            if (!cacheFile.empty()) {
+                writeAtlas(cacheFile, hash, pages, regions);
+            }
+            postAtlas(std::move(pages), std::move(regions), promise);
+        }
+        catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    }
+
+    bool TextureManager::readAtlas(const std::string& cacheFile, uint64_t hash, AtlasPromise promise)
+    {
+        auto file = std::make_shared<MappedFile>(cacheFile);
+        const uint8_t* data = file->Data();
+        if (file->Size() < sizeof(AtlasFileHeader)) {
+            return false;
+        }
+
+        AtlasFileHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, atlasMagic, sizeof(header.magic)) != 0
+            || header.version != atlasVersion
+            || header.sourceHash != hash)
+        {
+            return false;
+        }
+
+        // a corrupt header could overflow sums of its fields, so each part is
+        // checked against the space left for it instead
+        const uint64_t size = file->Size();
+        const uint64_t namesStart = sizeof(header) + uint64_t{ header.regionCount } * sizeof(AtlasFileRegion);
+        if (header.pagesOffset > size
+            || namesStart > header.pagesOffset
+            || header.namesSize > header.pagesOffset - namesStart
+            || header.pageWidth > uint32_t(std::numeric_limits<int>::max())
+            || header.pageHeight > uint32_t(std::numeric_limits<int>::max()))
+        {
+            return false;
+        }
+
+        const uint64_t available = size - header.pagesOffset;
+        uint64_t pageBytes = uint64_t{ header.pageWidth } * header.pageHeight;
+        if (pageBytes > available / 4) {
+            return false;
+        }
+        pageBytes *= 4;
+        if (pageBytes && header.pageCount > available / pageBytes) {
+            return false;
+        }
+
+        const char* names = reinterpret_cast<const char*>(data + namesStart);
+        std::unordered_map<std::string, AtlasRegion> regions{ };
+        for (uint32_t i = 0; i < header.regionCount; ++i) {
+            AtlasFileRegion record;
+            std::memcpy(&record, data + sizeof(header) + i * sizeof(record), sizeof(record));
+            if (record.page >= header.pageCount
+                || record.nameOffset > header.namesSize
+                || record.nameLength > header.namesSize - record.nameOffset)
+            {
+                return false;
+            }
+            regions[std::string(names + record.nameOffset, record.nameLength)] = {
+                record.page,
+                { record.rect[0], record.rect[1] },
+                { record.rect[2], record.rect[3] } };
+        }
+
+        // pages point into the mapping and keep it open until they're uploaded
+        std::vector<Image> pages{ };
+        for (uint32_t i = 0; i < header.pageCount; ++i) {
+            pages.push_back({
+                static_cast<int>(header.pageWidth),
+                static_cast<int>(header.pageHeight),
+                4,
+                std::shared_ptr<const uint8_t>(file, data + header.pagesOffset + i * pageBytes) });
+        }
+
+        postAtlas(std::move(pages), std::move(regions), promise);
+        return true;
+    }
+
+    void TextureManager::postAtlas(std::vector<Image> pages, std::unordered_map<std::string, AtlasRegion> regions, AtlasPromise promise)
+    {
+        auto atlas = std::make_shared<Atlas>();
+        atlas->regions = std::move(regions);
+        if (pages.empty()) {
+            promise->set_value(*atlas);
+            return;
+        }
+
+        // a page per upload, so a big atlas spreads over several frames
+        for (size_t i = 0; i < pages.size(); ++i) {
+            bool last = i + 1 == pages.size();
+            post([atlas, page = std::move(pages[i]), promise, last] {
+                atlas->pages.push_back(upload(page));
+                if (last) {
+                    promise->set_value(*atlas);
+                }
+            });
+        }
+    }
+
+    void TextureManager::post(std::function<void()> upload)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        m_uploads.push_back(std::move(upload));
+    }
+
+    ThreadPool& TextureManager::workers()
+    {
+        std::call_once(m_started, [this] {
+            m_workers = std::make_unique<ThreadPool>(m_threads);
+        });
+        return *m_workers;
+    }
+
+
+    /*========================================================================*\
+    |  Pixel canvas                                                            |
+    \*========================================================================*/
+
+    namespace
+    {
+        static_assert(sizeof(Pixel) == 4, "canvas kernels treat a pixel as four packed bytes");
+
+        // x / 255, rounded, for x up to 255 * 255
+        inline uint32_t div255(uint32_t x)
+        {
+            x += 128;
+            return (x + (x >> 8)) >> 8;
+        }
+
+        void fillScalar(Pixel* dst, size_t count, Pixel color)
+        {
+            std::fill_n(dst, count, color);
+        }
+
+        // Pixels to fill one at a time before dst lands on an `align` boundary
+        inline size_t alignHead(const Pixel* dst, size_t count, size_t align)
+        {
+            size_t misalignment = reinterpret_cast<uintptr_t>(dst) & (align - 1);
+            return std::min((align - misalignment) % align / sizeof(Pixel), count);
+        }
+
+        // Source over destination: colour weighted by source alpha, and alpha
+        // accumulating the same way
+        void blendScalar(Pixel* dst, const Pixel* src, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i) {
+                const uint32_t a = src[i][3];
+                const uint32_t ia = 255 - a;
+                for (size_t c = 0; c < 3; ++c) {
+                    dst[i][c] = static_cast<uint8_t>(div255(src[i][c] * a + dst[i][c] * ia));
+                }
+                dst[i][3] = static_cast<uint8_t>(div255(a * 255 + dst[i][3] * ia));
+            }
+        }
+
+#if defined MOPE_ILLUSTRATOR_X86
+        MOPE_TARGET("sse2")
+        void fillSSE(Pixel* dst, size_t count, Pixel color)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &color, sizeof(bits));
+            const __m128i value = _mm_set1_epi32(static_cast<int>(bits));
+
+            // so no store straddles a cache line
+            size_t i = alignHead(dst, count, 16);
+            fillScalar(dst, i, color);
+            for (; i + 4 <= count; i += 4) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), value);
+            }
+            fillScalar(dst + i, count - i, color);
+        }
+
+        // Two pixels widened to 16 bits a channel
+        MOPE_TARGET("sse2")
+        inline __m128i blendWide(__m128i src, __m128i dst)
+        {
+            const __m128i full = _mm_set1_epi16(255);
+            const __m128i bias = _mm_set1_epi16(128);
+            const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+
+            __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xFF), 0xFF);
+            __m128i ia = _mm_sub_epi16(full, a);
+            __m128i weight = _mm_or_si128(_mm_andnot_si128(alphaLanes, a), _mm_and_si128(alphaLanes, full));
+
+            __m128i x = _mm_add_epi16(_mm_mullo_epi16(src, weight), _mm_mullo_epi16(dst, ia));
+            x = _mm_add_epi16(x, bias);
+            return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+        }
+
+        MOPE_TARGET("sse2")
+        void blendSSE(Pixel* dst, const Pixel* src, size_t count)
+        {
+            const __m128i zero = _mm_setzero_si128();
+
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+                __m128i lo = blendWide(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+                __m128i hi = blendWide(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+            }
+            blendScalar(dst + i, src + i, count - i);
+        }
+
+        MOPE_TARGET("avx2")
+        void fillAVX2(Pixel* dst, size_t count, Pixel color)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &color, sizeof(bits));
+            const __m256i value = _mm256_set1_epi32(static_cast<int>(bits));
+
+            size_t i = alignHead(dst, count, 32);
+            fillScalar(dst, i, color);
+            for (; i + 8 <= count; i += 8) {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), value);
+            }
+            fillSSE(dst + i, count - i, color);
+        }
+
+        // Four pixels widened to 16 bits a channel, two per 128-bit lane
+        MOPE_TARGET("avx2")
+        inline __m256i blendWide(__m256i src, __m256i dst)
+        {
+            const __m256i full = _mm256_set1_epi16(255);
+            const __m256i bias = _mm256_set1_epi16(128);
+            const __m256i alphaLanes = _mm256_set_epi16(
+                -1, 0, 0, 0, -1, 0, 0, 0,
+                -1, 0, 0, 0, -1, 0, 0, 0);
+
+            __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(src, 0xFF), 0xFF);
+            __m256i ia = _mm256_sub_epi16(full, a);
+            __m256i weight = _mm256_or_si256(_mm256_andnot_si256(alphaLanes, a), _mm256_and_si256(alphaLanes, full));
+
+            __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(src, weight), _mm256_mullo_epi16(dst, ia));
+            x = _mm256_add_epi16(x, bias);
+            return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+        }
+
+        MOPE_TARGET("avx2")
+        void blendAVX2(Pixel* dst, const Pixel* src, size_t count)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+                // unpacking and packing both work within 128-bit lanes, so
+                // the pixels come back out in order
+                __m256i lo = blendWide(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+                __m256i hi = blendWide(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_packus_epi16(lo, hi));
+            }
+            blendSSE(dst + i, src + i, count - i);
+        }
+#endif
+
+        void fillSpan(Pixel* dst, size_t count, Pixel color, simd::Level level)
+        {
+            switch (level) {
+#if defined MOPE_ILLUSTRATOR_X86
+            case simd::Level::AVX2:
+                fillAVX2(dst, count, color);
+                break;
+            case simd::Level::SSE:
+                fillSSE(dst, count, color);
+                break;
+#endif
+            default:
+                fillScalar(dst, count, color);
+                break;
+            }
+        }
+
+        void blendSpan(Pixel* dst, const Pixel* src, size_t count, simd::Level level)
+        {
+            switch (level) {
+#if defined MOPE_ILLUSTRATOR_X86
+            case simd::Level::AVX2:
+                blendAVX2(dst, src, count);
+                break;
+            case simd::Level::SSE:
+                blendSSE(dst, src, count);
+                break;
+#endif
+            default:
+                blendScalar(dst, src, count);
+                break;
+            }
+        }
+    }
+
+    PixelCanvas::PixelCanvas(int width, int height)
+        : m_width{ width }
+        , m_height{ height }
+    {
+        if (width <= 0 || height <= 0) {
+            throw std::runtime_error("Canvas dimensions must be positive.");
+        }
+
+        const size_t count = static_cast<size_t>(width) * height;
+        void* storage = ::operator new(count * sizeof(Pixel), std::align_val_t{ settings::canvasAlignment });
+        m_pixels = static_cast<Pixel*>(storage);
+        std::uninitialized_fill_n(m_pixels, count, Pixel{ 0, 0, 0, 0 });
+    }
+
+    PixelCanvas::~PixelCanvas()
+    {
+        release();
+        ::operator delete(m_pixels, std::align_val_t{ settings::canvasAlignment });
+    }
+
+    int PixelCanvas::Width() const
+    {
+        return m_width;
+    }
+
+    int PixelCanvas::Height() const
+    {
+        return m_height;
+    }
+
+    Pixel* PixelCanvas::Data()
+    {
+        return m_pixels;
+    }
+
+    const Pixel* PixelCanvas::Data() const
+    {
+        return m_pixels;
+    }
+
+    PixelCanvas::Source PixelCanvas::Region(int x, int y, int width, int height) const
+    {
+        x = std::clamp(x, 0, m_width);
+        y = std::clamp(y, 0, m_height);
+        width = std::clamp(width, 0, m_width - x);
+        height = std::clamp(height, 0, m_height - y);
+        return { m_pixels + static_cast<size_t>(y) * m_width + x, width, height, m_width };
+    }
+
+    void PixelCanvas::MarkDirty(int x, int y, int width, int height)
+    {
+        Rect rect = clip(x, y, int64_t{ x } + width, int64_t{ y } + height);
+        if (rect.x0 < rect.x1 && rect.y0 < rect.y1) {
+            markDirty(rect);
+        }
+    }
+
+    Pixel PixelCanvas::GetPixel(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= m_width || y >= m_height) {
+            return Pixel{ 0, 0, 0, 0 };
+        }
+        return m_pixels[static_cast<size_t>(y) * m_width + x];
+    }
+
+    void PixelCanvas::Draw(int x, int y, Pixel color)
+    {
+        if (x < 0 || y < 0 || x >= m_width || y >= m_height) {
+            return;
+        }
+        row(y)[x] = color;
+        markDirty({ x, y, x + 1, y + 1 });
+    }
+
+    void PixelCanvas::Clear(Pixel color)
+    {
+        fillSpan(m_pixels, static_cast<size_t>(m_width) * m_height, color, simd::Active());
+        m_dirty.assign(1, Rect{ 0, 0, m_width, m_height });
+    }
+
+    void PixelCanvas::FillRect(int x, int y, int width, int height, Pixel color)
+    {
+        fill(clip(x, y, int64_t{ x } + width, int64_t{ y } + height), color);
+    }
+
+    void PixelCanvas::DrawLine(int x0, int y0, int x1, int y1, Pixel color)
+    {
+        // straight lines are just thin rectangles
+        if (y0 == y1) {
+            fill(clip(std::min(x0, x1), y0, int64_t{ std::max(x0, x1) } + 1, int64_t{ y0 } + 1), color);
+            return;
+        }
+        if (x0 == x1) {
+            fill(clip(x0, std::min(y0, y1), int64_t{ x0 } + 1, int64_t{ std::max(y0, y1) } + 1), color);
+            return;
+        }
+
+        // Liang-Barsky: trim the line to the canvas' pixel centers before
+        // walking it, so no steps are spent off the canvas. Lines already on
+        // it are left alone, and come out the same as untrimmed.
+        const double fx = x0;
+        const double fy = y0;
+        const double fdx = double(x1) - x0;
+        const double fdy = double(y1) - y0;
+        double t0 = 0.0;
+        double t1 = 1.0;
+        auto trim = [&](double p, double q) {
+            // keep the part where p * t <= q
+            if (p == 0.0) {
+                return q >= 0.0;
+            }
+            const double t = q / p;
+            if (p < 0.0) {
+                t0 = std::max(t0, t);
+            }
+            else {
+                t1 = std::min(t1, t);
+            }
+            return t0 <= t1;
+        };
+        if (!trim(-fdx, fx) || !trim(fdx, m_width - 1 - fx)
+            || !trim(-fdy, fy) || !trim(fdy, m_height - 1 - fy))
+        {
+            return;
+        }
+        if (t0 > 0.0) {
+            x0 = static_cast<int>(std::lround(fx + t0 * fdx));
+            y0 = static_cast<int>(std::lround(fy + t0 * fdy));
+        }
+        if (t1 < 1.0) {
+            x1 = static_cast<int>(std::lround(fx + t1 * fdx));
+            y1 = static_cast<int>(std::lround(fy + t1 * fdy));
+        }
+
+        const Rect rect{ std::min(x0, x1), std::min(y0, y1), std::max(x0, x1) + 1, std::max(y0, y1) + 1 };
+
+        // Bresenham, stepping whichever axis is longer; every point lies
+        // between the trimmed ends, so on the canvas
+        const int dx = std::abs(x1 - x0);
+        const int dy = -std::abs(y1 - y0);
+        const int sx = x0 < x1 ? 1 : -1;
+        const int sy = y0 < y1 ? 1 : -1;
+        int error = dx + dy;
+        for (;;) {
+            row(y0)[x0] = color;
+            if (x0 == x1 && y0 == y1) {
+                break;
+            }
+            int twice = 2 * error;
+            if (twice >= dy) {
+                error += dy;
+                x0 += sx;
+            }
+            if (twice <= dx) {
+                error += dx;
+                y0 += sy;
+            }
+        }
+        markDirty(rect);
+    }
+
+    namespace
+    {
+        // Half the width of a circle of `radius` at `offset` rows from its
+        // center: the largest x with x * x + offset * offset <= radius * (radius + 1)
+        int64_t circleHalfWidth(int64_t radius, int64_t offset)
+        {
+            const int64_t limit = radius * (radius + 1) - offset * offset;
+            if (limit < 0) {
+                return -1;
+            }
+            int64_t half = static_cast<int64_t>(std::sqrt(static_cast<double>(limit)));
+            while (half * half > limit) {
+                --half;
+            }
+            while ((half + 1) * (half + 1) <= limit) {
+                ++half;
+            }
+            return half;
+        }
+    }
+
+    void PixelCanvas::DrawCircle(int x, int y, int radius, Pixel color)
+    {
+        if (radius < 0) {
+            return;
+        }
+        const Rect rect = clip(int64_t{ x } - radius, int64_t{ y } - radius, int64_t{ x } + radius + 1, int64_t{ y } + radius + 1);
+        if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1) {
+            return;
+        }
+
+        const simd::Level level = simd::Active();
+        auto span = [&](int64_t left, int64_t right, int py) {
+            left = std::max<int64_t>(left, 0);
+            right = std::min<int64_t>(right + 1, m_width);
+            if (right - left > 8) {
+                fillSpan(row(py) + left, static_cast<size_t>(right - left), color, level);
+            }
+            else if (left < right) {
+                std::fill(row(py) + left, row(py) + right, color);
+            }
+        };
+
+        // only the rows on the canvas; each one gets the outline from its own
+        // half-width in to the next row out's, so steep parts stay connected
+        auto halfWidth = [&](int64_t py) { return circleHalfWidth(radius, py - y); };
+        int64_t below = halfWidth(int64_t{ rect.y0 } - 1);
+        int64_t here = halfWidth(rect.y0);
+        for (int py = rect.y0; py < rect.y1; ++py) {
+            const int64_t above = halfWidth(int64_t{ py } + 1);
+            const int64_t inner = std::min((py < y ? below : above) + 1, here);
+            span(x - here, x - inner, py);
+            span(x + inner, x + here, py);
+            below = here;
+            here = above;
+        }
+        markDirty(rect);
+    }
+
+    void PixelCanvas::FillCircle(int x, int y, int radius, Pixel color)
+    {
+        if (radius < 0) {
+            return;
+        }
+        const Rect rect = clip(int64_t{ x } - radius, int64_t{ y } - radius, int64_t{ x } + radius + 1, int64_t{ y } + radius + 1);
+        if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1) {
+            return;
+        }
+
+        // one span per canvas row, the same width as DrawCircle()'s outline
+        const simd::Level level = simd::Active();
+        for (int py = rect.y0; py < rect.y1; ++py) {
+            const int64_t half = circleHalfWidth(radius, int64_t{ py } - y);
+            const int64_t left = std::max<int64_t>(int64_t{ x } - half, 0);
+            const int64_t right = std::min<int64_t>(int64_t{ x } + half + 1, m_width);
+            if (left < right) {
+                fillSpan(row(py) + left, static_cast<size_t>(right - left), color, level);
+            }
+        }
+        markDirty(rect);
+    }
+
+    void PixelCanvas::Blit(int x, int y, const Source& source, int scale)
+    {
+        blit(x, y, source, scale, false);
+    }
+
+    void PixelCanvas::BlendBlit(int x, int y, const Source& source, int scale)
+    {
+        blit(x, y, source, scale, true);
+    }
+
+    void PixelCanvas::Upload()
+    {
+        // the first upload sends everything
+        if (!m_made) {
+            m_texture.Make(m_width, m_height, m_pixels);
+            m_made = true;
+            m_dirty.clear();
+            return;
+        }
+        if (m_dirty.empty()) {
+            return;
+        }
+
+        if (glBufferStorage) {
+            // dirty rectangles never overlap, so they fit in one canvas' worth
+            size_t size = 0;
+            for (const Rect& rect : m_dirty) {
+                size += static_cast<size_t>(rect.x1 - rect.x0) * (rect.y1 - rect.y0) * sizeof(Pixel);
+            }
+            if (size > m_segmentSize) {
+                grow(size);
+            }
+        }
+
+        if (m_mapped) {
+            uploadMapped();
+        }
+        else {
+            uploadDirect();
+        }
+        m_dirty.clear();
+    }
+
+    Texture2D PixelCanvas::Texture() const
+    {
+        return m_texture;
+    }
+
+    Pixel* PixelCanvas::row(int y)
+    {
+        return m_pixels + static_cast<size_t>(y) * m_width;
+    }
+
+    PixelCanvas::Rect PixelCanvas::clip(int64_t x0, int64_t y0, int64_t x1, int64_t y1) const
+    {
+        return {
+            static_cast<int>(std::clamp<int64_t>(x0, 0, m_width)),
+            static_cast<int>(std::clamp<int64_t>(y0, 0, m_height)),
+            static_cast<int>(std::clamp<int64_t>(x1, 0, m_width)),
+            static_cast<int>(std::clamp<int64_t>(y1, 0, m_height))
+        };
+    }
+
+    void PixelCanvas::fill(Rect rect, Pixel color)
+    {
+        if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1) {
+            return;
+        }
+
+        const simd::Level level = simd::Active();
+        for (int j = rect.y0; j < rect.y1; ++j) {
+            fillSpan(row(j) + rect.x0, rect.x1 - rect.x0, color, level);
+        }
+        markDirty(rect);
+    }
+
+    void PixelCanvas::markDirty(Rect rect)
+    {
+        // swallow every rectangle this one overlaps or touches, starting over
+        // whenever it grows
+        for (size_t i = 0; i < m_dirty.size();) {
+            const Rect& other = m_dirty[i];
+            if (other.x0 <= rect.x1 && rect.x0 <= other.x1 && other.y0 <= rect.y1 && rect.y0 <= other.y1) {
+                rect = {
+                    std::min(rect.x0, other.x0), std::min(rect.y0, other.y0),
+                    std::max(rect.x1, other.x1), std::max(rect.y1, other.y1)
+                };
+                m_dirty[i] = m_dirty.back();
+                m_dirty.pop_back();
+                i = 0;
+            }
+            else {
+                ++i;
+            }
+        }
+        m_dirty.push_back(rect);
+
+        if (m_dirty.size() > settings::canvasDirtyRects) {
+            Rect bounds = m_dirty.front();
+            for (const Rect& other : m_dirty) {
+                bounds = {
+                    std::min(bounds.x0, other.x0), std::min(bounds.y0, other.y0),
+                    std::max(bounds.x1, other.x1), std::max(bounds.y1, other.y1)
+                };
+            }
+            m_dirty.assign(1, bounds);
+        }
+    }
+
+    void PixelCanvas::blit(int x, int y, const Source& source, int scale, bool blend)
+    {
+        if (scale < 1 || !source.pixels || source.width <= 0 || source.height <= 0) {
+            return;
+        }
+
+        const Rect rect = clip(x, y,
+            x + int64_t{ source.width } * scale, y + int64_t{ source.height } * scale);
+        if (rect.x0 >= rect.x1 || rect.y0 >= rect.y1) {
+            return;
+        }
+
+        // the source columns under the clipped span, and how much of the
+        // first one got clipped off; offsets from (x, y) can pass INT_MAX
+        const int first = static_cast<int>((int64_t{ rect.x0 } - x) / scale);
+        const int skip = static_cast<int>(int64_t{ rect.x0 } - x - int64_t{ first } * scale);
+        const size_t span = rect.x1 - rect.x0;
+
+        // blitting from this canvas, rows can be overwritten before they're
+        // read; work from a copy instead
+        Source from = source;
+        const std::less<const Pixel*> before{ };
+        if (!before(source.pixels, m_pixels) && before(source.pixels, m_pixels + static_cast<size_t>(m_width) * m_height)) {
+            const size_t width = source.width;
+            m_copy.resize(width * source.height);
+            for (int i = 0; i < source.height; ++i) {
+                std::memcpy(m_copy.data() + i * width, source.pixels + static_cast<size_t>(i) * source.stride, width * sizeof(Pixel));
+            }
+            from = { m_copy.data(), source.width, source.height, source.width };
+        }
+
+        const simd::Level level = simd::Active();
+        for (int j = rect.y0; j < rect.y1;) {
+            const int sourceRow = static_cast<int>((int64_t{ j } - y) / scale);
+            const Pixel* src = from.pixels + static_cast<size_t>(sourceRow) * from.stride;
+
+            // widen the part of the source row on the canvas once for every
+            // canvas row it covers
+            const Pixel* line = src + first;
+            if (scale > 1) {
+                m_scratch.resize(span);
+                Pixel* out = m_scratch.data();
+                size_t left = span;
+                size_t block = static_cast<size_t>(scale - skip);
+                for (int i = first; left; ++i) {
+                    const size_t n = std::min(block, left);
+                    std::fill_n(out, n, src[i]);
+                    out += n;
+                    left -= n;
+                    block = static_cast<size_t>(scale);
+                }
+                line = m_scratch.data();
+            }
+
+            const int end = static_cast<int>(std::min<int64_t>(y + (sourceRow + 1) * int64_t{ scale }, rect.y1));
+            for (; j < end; ++j) {
+                if (blend) {
+                    blendSpan(row(j) + rect.x0, line, span, level);
+                }
+                else {
+                    std::memcpy(row(j) + rect.x0, line, span * sizeof(Pixel));
+                }
+            }
+        }
+        markDirty(rect);
+    }
+
+    void PixelCanvas::uploadMapped()
+    {
+        // one millisecond at a time, until the GPU is done with this segment
+        GLsync& fence = m_fences[m_current];
+        if (fence) {
+            constexpr GLuint64 timeout = 1000000;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout) == GL_TIMEOUT_EXPIRED)
+            { }
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+
+        m_texture.Bind();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+
+        // rectangles go in tightly packed, one after another
+        size_t offset = m_current * m_segmentSize;
+        for (const Rect& rect : m_dirty) {
+            const size_t width = rect.x1 - rect.x0;
+            const size_t bytes = width * sizeof(Pixel);
+            uint8_t* dst = m_mapped + offset;
+            if (static_cast<int>(width) == m_width) {
+                std::memcpy(dst, row(rect.y0), bytes * (rect.y1 - rect.y0));
+            }
+            else {
+                for (int j = rect.y0; j < rect.y1; ++j, dst += bytes) {
+                    std::memcpy(dst, row(j) + rect.x0, bytes);
+                }
+            }
+
+            glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.y0, static_cast<GLsizei>(width), rect.y1 - rect.y0,
+                GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<const void*>(offset));
+            offset += bytes * (rect.y1 - rect.y0);
+        }
+
+        // anything else passing pointers to glTex(Sub)Image2D expects no unpack buffer
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_current = (m_current + 1) % settings::canvasUploadSegments;
+    }
+
+    void PixelCanvas::uploadDirect()
+    {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, m_width);
+        for (const Rect& rect : m_dirty) {
+            m_texture.UpdateData(row(rect.y0) + rect.x0, rect.x0, rect.y0, rect.x1 - rect.x0, rect.y1 - rect.y0);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+
+    void PixelCanvas::grow(size_t size)
+    {
+        size_t new_size = m_segmentSize ? m_segmentSize : size;
+        while (new_size < size) {
+            new_size *= 2;
+        }
+
+        constexpr size_t align = settings::canvasAlignment;
+        new_size = (new_size + align - 1) / align * align;
+
+        release();
+        m_segmentSize = new_size;
+
+        constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        const size_t total = m_segmentSize * settings::canvasUploadSegments;
+
+        glGenBuffers(1, &m_buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, total, nullptr, flags);
+        m_mapped = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total, flags));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    void PixelCanvas::release()
+    {
+        GLsync fences[settings::canvasUploadSegments]{ };
+        bool any = m_buffer != 0;
+        for (size_t i = 0; i < settings::canvasUploadSegments; ++i) {
+            fences[i] = std::exchange(m_fences[i], nullptr);
+            any = any || fences[i];
+        }
+
+        // as with SSBORing, deleted where the context lives
+        if (any) {
+            gl::Post([id = m_buffer, mapped = m_mapped != nullptr, fences] {
+                for (GLsync fence : fences) {
+                    if (fence) {
+                        glDeleteSync(fence);
+                    }
+                }
+                if (id) {
+                    GLuint name = id;
+                    if (mapped) {
+                        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, name);
+                        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                    }
+                    glDeleteBuffers(1, &name);
+                }
+            });
+        }
+        m_buffer = 0;
+        m_mapped = nullptr;
+        m_segmentSize = 0;
+        m_current = 0;
+    }
+
+
+    /*========================================================================*\
+    |  Sprite                                                                  |
+    \*========================================================================*/
+
+    Instance::Instance(vec3f position, vec3f scale, float rotation)
+        : Instance(Data{ std::move(position), std::move(scale), std::move(rotation) })
+    { }
+
+    Instance::Instance(Data data)
+        : m_data{ std::move(data) }
+    { }
+
+    vec3f Instance::Position() const { return m_data.position; }
+    vec3f Instance::Scale() const { return m_data.scale; }
+    float Instance::Rotation() const { return m_data.rotation; }
+
+    void Instance::MoveTo(vec3f position)
+    {
+        m_data.position = std::move(position);
+        m_recompute = true;
+    }
+
+    void Instance::Move(const vec3f& direction)
+    {
+        m_data.position += direction;
+        m_recompute = true;
+    }
+
+    void Instance::SetScale(vec3f factors)
+    {
+        m_data.scale = std::move(factors);
+        m_recompute = true;
+    }
+
+    void Instance::ScaleBy(const vec3f& factors)
+    {
+        m_data.scale.scaleby(factors);
+        m_recompute = true;
+    }
+
+    void Instance::SetAngle(float angle)
+    {
+        m_data.rotation = angle;
+        m_recompute = true;
+    }
+
+    void Instance::Rotate(float angle)
+    {
+        m_data.rotation += angle;
+        m_recompute = true;
+    }
+
+    mat4f Instance::ComputeModel(const Data& data)
+    {
+        // same kernel as the batched path, so both agree to the bit
+        const TransformArrays view{
+            &data.position.elements[0], &data.position.elements[1], &data.position.elements[2],
+            &data.scale.elements[0], &data.scale.elements[1], &data.scale.elements[2],
+            &data.rotation
+        };
+
+        mat4f model;
+        BuildModels(view, 1, &model, simd::Level::Scalar);
+        return model;
+    }
+
+    const mat4f* Instance::Model()
+    {
+        if (m_recompute) {
+            m_model = ComputeModel(m_data);
+            m_recompute = false;
+        }
+
+        return &m_model;
+    }
+
+    bool InstanceStore::Handle::operator==(const Handle& other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool InstanceStore::Handle::operator!=(const Handle& other) const
+    {
+        return !(*this == other);
+    }
+
+    InstanceStore::Handle InstanceStore::Add(Instance::Data data)
+    {
+        uint32_t slot;
+        if (m_freeSlots.empty()) {
+            slot = static_cast<uint32_t>(m_slots.size());
+            m_slots.push_back({ 0, 0 });
+        }
+        else {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+
+        size_t idx = m_owners.size();
+        m_slots[slot].dense = static_cast<uint32_t>(idx);
+        m_data.push(data);
+        m_models.emplace_back();
+        m_rects.push_back(m_defaultRect);
+        m_ownRects.push_back(false);
+        m_owners.push_back(slot);
+        m_dirtyFlags.push_back(false);
+        markDirty(idx);
+
+        return { slot, m_slots[slot].generation };
+    }
+
+    bool InstanceStore::Remove(Handle handle)
+    {
+        if (!Contains(handle)) {
+            return false;
+        }
+
+        // swap the last instance into the hole
+        size_t idx = m_slots[handle.index].dense;
+        size_t last = m_owners.size() - 1;
+        if (idx != last) {
+            m_data.copy(last, idx);
+            m_models[idx] = m_models[last];
+            m_rects[idx] = m_rects[last];
+            m_ownRects[idx] = m_ownRects[last];
+            m_owners[idx] = m_owners[last];
+            m_slots[m_owners[idx]].dense = static_cast<uint32_t>(idx);
+            markDirty(idx);
+        }
+        m_data.pop();
+        m_models.pop_back();
+        m_rects.pop_back();
+        m_ownRects.pop_back();
+        m_owners.pop_back();
+        m_dirtyFlags.pop_back();
+
+        // bump the generation so that outstanding handles go stale
+        ++m_slots[handle.index].generation;
+        m_freeSlots.push_back(handle.index);
+        return true;
+    }
+
+    bool InstanceStore::Contains(Handle handle) const
+    {
+        return handle.index < m_slots.size()
+            && m_slots[handle.index].generation == handle.generation
+            && m_slots[handle.index].dense < m_owners.size()
+            && m_owners[m_slots[handle.index].dense] == handle.index;
+    }
+
+    void InstanceStore::Clear()
+    {
+        for (uint32_t slot : m_owners) {
+            ++m_slots[slot].generation;
+            m_freeSlots.push_back(slot);
+        }
+        m_data.clear();
+        m_models.clear();
+        m_rects.clear();
+        m_ownRects.clear();
+        m_owners.clear();
+        m_dirtyFlags.clear();
+        m_dirty.clear();
+    }
+
+    Instance::Data InstanceStore::Get(Handle handle) const
+    {
+        return m_data.get(denseIndex(handle));
+    }
+
+    void InstanceStore::Set(Handle handle, Instance::Data data)
+    {
+        size_t idx = denseIndex(handle);
+        m_data.set(idx, data);
+        markDirty(idx);
+    }
+
+    void InstanceStore::MoveTo(Handle handle, vec3f position)
+    {
+        size_t idx = denseIndex(handle);
+        m_data.px[idx] = position.x();
+        m_data.py[idx] = position.y();
+        m_data.pz[idx] = position.z();
+        markDirty(idx);
+    }
+
+    void InstanceStore::SetScale(Handle handle, vec3f factors)
+    {
+        size_t idx = denseIndex(handle);
+        m_data.sx[idx] = factors.x();
+        m_data.sy[idx] = factors.y();
+        m_data.sz[idx] = factors.z();
+        markDirty(idx);
+    }
+
+    void InstanceStore::SetAngle(Handle handle, float angle)
+    {
+        size_t idx = denseIndex(handle);
+        m_data.rotation[idx] = angle;
+        markDirty(idx);
+    }
+
+    void InstanceStore::Move(Handle handle, const vec3f& displacement)
+    {
+        size_t idx = denseIndex(handle);
+        m_data.px[idx] += displacement.x();
+        m_data.py[idx] += displacement.y();
+        m_data.pz[idx] += displacement.z();
+        markDirty(idx);
+    }
+
+    void InstanceStore::ScaleBy(Handle handle, const vec3f& factors)
+    {
+        size_t idx = denseIndex(handle);
+        m_data.sx[idx] *= factors.x();
+        m_data.sy[idx] *= factors.y();
+        m_data.sz[idx] *= factors.z();
+        markDirty(idx);
+    }
+
+    void InstanceStore::Rotate(Handle handle, float angle)
+    {
+        size_t idx = denseIndex(handle);
+        m_data.rotation[idx] += angle;
+        markDirty(idx);
+    }
+
+    void InstanceStore::SetRect(Handle handle, vec2f leftBottom, vec2f rightTop)
+    {
+        size_t idx = denseIndex(handle);
+        m_rects[idx] = { leftBottom.x(), leftBottom.y(), rightTop.x(), rightTop.y() };
+        m_ownRects[idx] = true;
+        m_hasRects = true;
+        markDirty(idx);
+    }
+
+    void InstanceStore::SetDefaultRect(vec2f leftBottom, vec2f rightTop)
+    {
+        vec4f rect{ leftBottom.x(), leftBottom.y(), rightTop.x(), rightTop.y() };
+        bool same = true;
+        for (size_t i = 0; i < 4; ++i) {
+            same = same && rect[i] == m_defaultRect[i];
+        }
+        if (same) {
+            return;
+        }
+
+        m_defaultRect = rect;
+        for (size_t idx = 0; idx < m_rects.size(); ++idx) {
+            if (!m_ownRects[idx]) {
+                m_rects[idx] = rect;
+                // nothing reads the rects until some instance sets its own
+                if (m_hasRects) {
+                    markDirty(idx);
+                }
+            }
+        }
+    }
+
+    size_t InstanceStore::Size() const
+    {
+        return m_owners.size();
+    }
+
+    InstanceStore::Handle InstanceStore::HandleAt(size_t idx) const
+    {
+        uint32_t slot = m_owners[idx];
+        return { slot, m_slots[slot].generation };
+    }
+
+    const mat4f* InstanceStore::Models() const
+    {
+        return m_models.data();
+    }
+
+    const vec4f* InstanceStore::Rects() const
+    {
+        return m_rects.data();
+    }
+
+    bool InstanceStore::HasRects() const
+    {
+        return m_hasRects;
+    }
+
+    const std::vector<IndexRange>& InstanceStore::Update()
+    {
+        m_ranges.clear();
+
+        // removals may have left indices past the end
+        auto end = std::remove_if(m_dirty.begin(), m_dirty.end(),
+            [size = m_owners.size()](uint32_t idx) { return idx >= size; });
+        m_dirty.erase(end, m_dirty.end());
+        std::sort(m_dirty.begin(), m_dirty.end());
+
+        for (uint32_t idx : m_dirty) {
+            m_dirtyFlags[idx] = false;
+
+            if (!m_ranges.empty() && idx <= m_ranges.back().end + settings::dirtyRangeMergeGap) {
+                m_ranges.back().end = idx + 1;
+            }
+            else {
+                m_ranges.push_back({ idx, idx + size_t{ 1 } });
+            }
+        }
+        m_dirty.clear();
+
+        // rebuilding the odd clean instance inside a range is cheaper than
+        // breaking up the batch
+        TransformArrays view = m_data.view();
+        for (const IndexRange& range : m_ranges) {
+            BuildModels(view.offset(range.begin), range.end - range.begin, &m_models[range.begin]);
+        }
+
+        return m_ranges;
+    }
+
+    size_t InstanceStore::denseIndex(Handle handle) const
+    {
+        assert(Contains(handle));
+        return m_slots[handle.index].dense;
+    }
+
+    void InstanceStore::markDirty(size_t idx)
+    {
+        if (!m_dirtyFlags[idx]) {
+            m_dirtyFlags[idx] = true;
+            m_dirty.push_back(static_cast<uint32_t>(idx));
+        }
+    }
+
+    void InstanceStore::Columns::push(const Instance::Data& data)
+    {
+        px.push_back(data.position.x());
+        py.push_back(data.position.y());
+        pz.push_back(data.position.z());
+        sx.push_back(data.scale.x());
+        sy.push_back(data.scale.y());
+        sz.push_back(data.scale.z());
+        rotation.push_back(data.rotation);
+    }
+
+    void InstanceStore::Columns::pop()
+    {
+        for (auto* column : { &px, &py, &pz, &sx, &sy, &sz, &rotation }) {
+            column->pop_back();
+        }
+    }
+
+    void InstanceStore::Columns::clear()
+    {
+        for (auto* column : { &px, &py, &pz, &sx, &sy, &sz, &rotation }) {
+            column->clear();
+        }
+    }
+
+    void InstanceStore::Columns::copy(size_t from, size_t to)
+    {
+        for (auto* column : { &px, &py, &pz, &sx, &sy, &sz, &rotation }) {
+            (*column)[to] = (*column)[from];
+        }
+    }
+
+    void InstanceStore::Columns::set(size_t idx, const Instance::Data& data)
+    {
+        px[idx] = data.position.x();
+        py[idx] = data.position.y();
+        pz[idx] = data.position.z();
+        sx[idx] = data.scale.x();
+        sy[idx] = data.scale.y();
+        sz[idx] = data.scale.z();
+        rotation[idx] = data.rotation;
+    }
+
+    Instance::Data InstanceStore::Columns::get(size_t idx) const
+    {
+        return {
+            { px[idx], py[idx], pz[idx] },
+            { sx[idx], sy[idx], sz[idx] },
+            rotation[idx]
+        };
+    }
+
+    TransformArrays InstanceStore::Columns::view() const
+    {
+        return {
+            px.data(), py.data(), pz.data(),
+            sx.data(), sy.data(), sz.data(),
+            rotation.data()
+        };
+    }
+
+    Sprite::Sprite(Shader shader)
+        : m_shader{ shader }
+    { }
+
+    Sprite::Sprite(Shader shader, Texture2D texture)
+        : m_shader{ shader }
+        , m_texture{ texture }
+    { }
+
+    Sprite::Sprite(Shader shader, Texture2D texture, vec2f left_bottom, vec2f right_top)
+        : m_shader{ shader }
+        , m_texture{ texture }
+        , m_leftBottom{ left_bottom }
+        , m_rightTop{ right_top }
+    { }
+
+    void Sprite::Render()
+    {
+        if (!m_prepared) {
+            prepare();
+        }
+        else if (m_verticesDirty) {
+            fillVertices();
+        }
+        m_verticesDirty = false;
+        
+        m_shader.Bind();
+        m_texture.Bind();
+        m_vao.Bind();
+
+        drawCall();
+    }
+
+    void Sprite::Submit(RenderQueue&)
+    {
+        Render();
+    }
+
+    void Sprite::SetTexture(Texture2D tex)
+    {
+        m_texture = tex;
+    }
+
+    void Sprite::SetTexture(vec2f left_bottom, vec2f right_top)
+    {
+        m_leftBottom = left_bottom;
+        m_rightTop = right_top;
+        // may be called off the render thread; the VBO catches up in Render()
+        m_verticesDirty = true;
+    }
+
+    void Sprite::SetTexture(Texture2D tex, vec2f left_bottom, vec2f right_top)
+    {
+        SetTexture(tex);
+        SetTexture(left_bottom, right_top);
+    }
+
+    void Sprite::prepare()
+    {
+        // need to bind VBO before filling attribs (I think)
+        fillVertices();
+        fillAttribArray();
+        fillIndices();
+        m_prepared = true;
+    }
+
+    void Sprite::fillVertices()
+    {
+        float left = m_leftBottom.x(),
+            bottom = m_leftBottom.y(),
+            right = m_rightTop.x(),
+            top = m_rightTop.y();
+        const GLfloat vertices[] = {
+            -0.5f,  -0.5f,  left,   bottom,
+            0.5f,   -0.5f,  right,  bottom,
+            -0.5f,  0.5f,   left,   top,
+            0.5f,   0.5f,   right,  top
+        };
+
+        m_vbo.Fill(vertices, sizeof(vertices));
+    }
+
+    void Sprite::fillIndices()
+    {
+        const GLubyte indices[4] = { 0, 1, 2, 3 };
+        m_ebo.Fill(indices, sizeof(indices));
+    }
+
+    void Sprite::fillAttribArray()
+    {
+        m_vao.Bind();
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat[4]), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat[4]), (void*)(sizeof(GLfloat[2])));
+    }
+
+    BasicSprite::BasicSprite(
+        Data data,
+        Shader shader,
+        Texture2D texture,
+        vec2f leftBottom,
+        vec2f rightTop
+    )
+        : Sprite{ shader, texture, leftBottom, rightTop }
+        , Instance{ data }
+    { }
+
+    void BasicSprite::Submit(RenderQueue& queue)
+    {
+        queue.Submit(m_shader, m_texture, m_data.position.z(), m_leftBottom, m_rightTop, *Model());
+    }
+
+    void BasicSprite::drawCall()
+    {
+        m_ssbo.Bind();
+
+        const mat4f* model = Model();
+        m_ssbo.Fill(model, sizeof(*model));
+
+        glDrawElements(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_BYTE, (void*)0); 
+    }
+
+    InstanceStore::Handle InstancedSprite::MakeInstance(vec3f position, vec3f scale, float rotation)
+    {
+        return MakeInstance({ position, scale, rotation });
+    }
+
+    InstanceStore::Handle InstancedSprite::MakeInstance(Instance::Data data)
+    {
+        return m_instances.Add(std::move(data));
+    }
+
+    bool InstancedSprite::DropInstance(InstanceStore::Handle handle)
+    {
+        return m_instances.Remove(handle);
+    }
+
+    InstanceStore& InstancedSprite::Instances()
+    {
+        return m_instances;
+    }
+
+    void InstancedSprite::Submit(RenderQueue& queue)
+    {
+        collectChanges();
+
+        const mat4f* models = m_instances.Models();
+        const vec4f* rects = m_instances.HasRects() ? m_instances.Rects() : nullptr;
+        auto submit = [&](size_t i) {
+            vec2f leftBottom = rects ? vec2f{ rects[i].x(), rects[i].y() } : m_leftBottom;
+            vec2f rightTop = rects ? vec2f{ rects[i].z(), rects[i].w() } : m_rightTop;
+
+            // depth is the z translation
+            queue.Submit(m_shader, m_texture, models[i][3][2], leftBottom, rightTop, models[i]);
+        };
+
+        // the same instances drawCall() would draw; the queue's sort is
+        // stable, so a back-to-front order holds within each of its batches
+        const size_t count = m_instances.Size();
+        if (m_culling) {
+            cull();
+            m_stats = { m_visible.size(), count - m_visible.size() };
+            for (uint32_t i : m_visible) {
+                submit(i);
+            }
+        }
+        else {
+            m_stats = { count, 0 };
+            for (size_t i = 0; i < count; ++i) {
+                submit(i);
+            }
+        }
+    }
+
+    void InstancedSprite::SetViewProjection(const mat4f& viewProjection, bool backToFront)
+    {
+        useIndex();
+        m_culling = true;
+        m_backToFront = backToFront;
+        m_viewProjection = viewProjection;
+    }
+
+    void InstancedSprite::DisableCulling()
+    {
+        m_culling = false;
+    }
+
+    const InstancedSprite::CullStats& InstancedSprite::LastFrame() const
+    {
+        return m_stats;
+    }
+
+    void InstancedSprite::Query(const Bounds& region, std::vector<InstanceStore::Handle>& out)
+    {
+        useIndex();
+        collectChanges();
+
+        m_found.clear();
+        m_grid.Query(region, m_found);
+        for (uint32_t idx : m_found) {
+            out.push_back(m_instances.HandleAt(idx));
+        }
+    }
+
+    void InstancedSprite::Query(vec2f point, std::vector<InstanceStore::Handle>& out)
+    {
+        Query(Bounds{ { point.x(), point.y(), 0.f }, { point.x(), point.y(), 0.f } }, out);
+    }
+
+    void InstancedSprite::collectChanges()
+    {
+        // instances without rects of their own show the sprite's
+        m_instances.SetDefaultRect(m_leftBottom, m_rightTop);
+
+        const std::vector<IndexRange>& changed = m_instances.Update();
+        if (m_indexed) {
+            updateIndex(changed);
+        }
+        m_changed.insert(m_changed.end(), changed.begin(), changed.end());
+        limitRanges(m_changed);
+    }
+
+    void InstancedSprite::useIndex()
+    {
+        if (m_indexed) {
+            return;
+        }
+
+        // catch up on the matrices first, then index everything at once
+        collectChanges();
+        m_indexed = true;
+        updateIndex({ { 0, m_instances.Size() } });
+    }
+
+    void InstancedSprite::updateIndex(const std::vector<IndexRange>& changed)
+    {
+        // the grid is keyed by dense index, so removals just shorten it and
+        // whatever got swapped into a hole shows up among the changes
+        const size_t size = m_instances.Size();
+        while (m_grid.Size() > size) {
+            m_grid.Remove(static_cast<uint32_t>(m_grid.Size() - 1));
+        }
+
+        const mat4f* models = m_instances.Models();
+        for (const IndexRange& range : changed) {
+            for (size_t idx = range.begin; idx < std::min(range.end, size); ++idx) {
+                m_grid.Insert(static_cast<uint32_t>(idx), Bounds::OfQuad(models[idx]));
+            }
+        }
+    }
+
+    void InstancedSprite::cull()
+    {
+        Frustum frustum{ m_viewProjection };
+        m_visible.clear();
+        m_grid.Query(frustum, m_visible);
+
+        if (!m_backToFront) {
+            // in index order, for friendlier reads on the GPU
+            std::sort(m_visible.begin(), m_visible.end());
+            return;
+        }
+
+        const mat4f* models = m_instances.Models();
+        m_depthOrder.clear();
+        for (uint32_t idx : m_visible) {
+            const mat4f& model = models[idx];
+            m_depthOrder.push_back({ frustum.Depth({ model[3][0], model[3][1], model[3][2] }), idx });
+        }
+        std::sort(m_depthOrder.begin(), m_depthOrder.end(),
+            [](const auto& a, const auto& b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+        for (size_t i = 0; i < m_depthOrder.size(); ++i) {
+            m_visible[i] = m_depthOrder[i].second;
+        }
+    }
+
+    void InstancedSprite::drawCall()
+    {
+        // rebuild only the matrices that changed, and upload only those
+        collectChanges();
+        if (!m_instances.Size()) {
+            m_stats = { };
+            return;
+        }
+        m_ring.Upload(m_instances.Models(), m_instances.Size(), sizeof(mat4f), m_changed);
+
+        // per-instance texture rects ride along at binding 1
+        bool rects = m_instances.HasRects();
+        if (rects) {
+            m_rectRing.Upload(m_instances.Rects(), m_instances.Size(), sizeof(vec4f), m_changed);
+            m_shader.SetUniform("u_InstanceRects", 1);
+        }
+        m_changed.clear();
+
+        // with culling, only the indices of visible instances change hands
+        // each frame; the shader looks up everything else through them
+        size_t count = m_instances.Size();
+        if (m_culling) {
+            cull();
+            m_stats = { m_visible.size(), count - m_visible.size() };
+            count = m_visible.size();
+            if (count) {
+                m_visibleRange.assign(1, { 0, count });
+                m_indexRing.Upload(m_visible.data(), count, sizeof(uint32_t), m_visibleRange);
+                m_shader.SetUniform("u_InstanceIndirect", 1);
+            }
+        }
+        else {
+            m_stats = { count, 0 };
+        }
+
+        if (count) {
+            glDrawElementsInstanced(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_BYTE, (void*)0, count);
+        }
+
+        m_ring.Fence();
+        if (rects) {
+            m_rectRing.Fence();
+            m_shader.SetUniform("u_InstanceRects", 0);
+        }
+        if (m_culling && count) {
+            m_indexRing.Fence();
+            m_shader.SetUniform("u_InstanceIndirect", 0);
+        }
+    }
+
+    AnimatedSprite::AnimatedSprite(Data data, Shader shader)
+        : BasicSprite(data, shader)
+    { }
+
+    void AnimatedSprite::AddFrame(Frame frame)
+    {
+        m_frames.push_back(std::move(frame));
+    }
+
+    void AnimatedSprite::SetAll(std::vector<Frame> frames)
+    {
+        m_frames = frames;
+    }
+
+    void AnimatedSprite::DropFrame(size_t idx)
+    {
+        m_frames.erase(m_frames.begin() + idx);
+    }
+
+    void AnimatedSprite::DropAll()
+    {
+        m_frames.clear();
+    }
+
+    void AnimatedSprite::Next()
+    {
+        nextFrame();
+        updateTexture();
+    }
+
+    void AnimatedSprite::SwitchTo(size_t idx, bool ignore_elapsed)
+    {
+        m_currentFrame = idx;
+        m_ignoreElapsed = ignore_elapsed;
+        updateTexture();
+    }
+
+    void AnimatedSprite::Render(double elapsed)
+    {
+        Advance(elapsed);
+        BasicSprite::Render();
+    }
+
+    void AnimatedSprite::Advance(double elapsed)
+    {
+        if (!m_ignoreElapsed) {
+            m_currentFrameTime += elapsed;
+        }
+        m_ignoreElapsed = false;
+
+        bool updated = false;
+        while (m_currentFrameTime > m_frames[m_currentFrame].time) {
+            m_currentFrameTime -= m_frames[m_currentFrame].time;
+            nextFrame();
+            updated = true;
+        }
+        if (updated) {
+            updateTexture();
+        }
+    }
+
+    void AnimatedSprite::nextFrame()
+    {
+        if (++m_currentFrame >= m_frames.size())
+        {
+            m_currentFrame = 0;
+        }
+    }
+
+    void AnimatedSprite::updateTexture()
+    {
+        const Frame& frame = m_frames[m_currentFrame];
+        SetTexture(frame.texture, frame.leftBottom, frame.rightTop);
+    }
+
+    /*========================================================================*\
+    |  Animation                                                               |
+    \*========================================================================*/
+
+    double AnimationClip::Length() const
+    {
+        double length = 0.0;
+        for (const Frame& frame : frames) {
+            length += frame.duration;
+        }
+        return length;
+    }
+
+    void Animator::Play(InstanceStore::Handle instance, Clip clip, float speed, double time)
+    {
+        if (!clip || clip->frames.empty()) {
+            throw std::runtime_error("Can't play an animation clip with no frames.");
+        }
+
+        uint32_t trackIdx = track(std::move(clip));
+
+        // start inside the clip, so the first Update() doesn't count a loop
+        const Track& started = m_tracks[trackIdx];
+        if (started.length > 0.0 && started.clip->mode != AnimationClip::Mode::OneShot) {
+            double period = started.clip->mode == AnimationClip::Mode::PingPong ? 2.0 * started.length : started.length;
+            time -= std::floor(time / period) * period;
+        }
+
+        uint32_t idx = find(instance);
+        if (idx == none) {
+            idx = static_cast<uint32_t>(m_instances.size());
+            m_instances.push_back(instance);
+            m_track.push_back(trackIdx);
+            m_time.push_back(time);
+            m_speed.push_back(speed);
+            m_frame.push_back(none);
+
+            if (instance.index >= m_lookup.size()) {
+                m_lookup.resize(instance.index + size_t{ 1 }, none);
+            }
+            m_lookup[instance.index] = idx;
+        }
+        else {
+            release(m_track[idx]);
+            m_track[idx] = trackIdx;
+            m_time[idx] = time;
+            m_speed[idx] = speed;
+            m_frame[idx] = none;
+        }
+    }
+
+    bool Animator::Stop(InstanceStore::Handle instance)
+    {
+        uint32_t idx = find(instance);
+        if (idx == none) {
+            return false;
+        }
+        remove(idx);
+        return true;
+    }
+
+    bool Animator::Playing(InstanceStore::Handle instance) const
+    {
+        return find(instance) != none;
+    }
+
+    void Animator::SetSpeed(InstanceStore::Handle instance, float speed)
+    {
+        uint32_t idx = find(instance);
+        if (idx != none) {
+            m_speed[idx] = speed;
+        }
+    }
+
+    void Animator::Clear()
+    {
+        m_tracks.clear();
+        m_freeTracks.clear();
+        m_trackIndex.clear();
+        m_lookup.clear();
+        m_instances.clear();
+        m_track.clear();
+        m_time.clear();
+        m_speed.clear();
+        m_frame.clear();
+    }
+
+    size_t Animator::Size() const
+    {
+        return m_instances.size();
+    }
+
+    void Animator::Update(double elapsed, InstanceStore& store)
+    {
+        using Mode = AnimationClip::Mode;
+        using Kind = AnimationEvent::Kind;
+
+        m_changed.clear();
+        m_stopped.clear();
+        m_events.clear();
+
+        // advance every clock in one pass; only frame changes go any further
+        for (size_t i = 0; i < m_instances.size(); ++i) {
+            if (!store.Contains(m_instances[i])) {
+                m_stopped.push_back(static_cast<uint32_t>(i));
+                continue;
+            }
+
+            const Track& track = m_tracks[m_track[i]];
+            const double length = track.length;
+            double time = m_time[i] + elapsed * m_speed[i];
+            double local = 0.0;
+
+            if (length > 0.0) {
+                switch (track.clip->mode) {
+                case Mode::Loop:
+                    if (time >= length || time < 0.0) {
+                        time -= std::floor(time / length) * length;
+                        m_events.push_back({ m_instances[i], Kind::Looped, 0 });
+                    }
+                    local = time;
+                    break;
+
+                case Mode::PingPong:
+                    if (time >= 2.0 * length || time < 0.0) {
+                        time -= std::floor(time / (2.0 * length)) * 2.0 * length;
+                        m_events.push_back({ m_instances[i], Kind::Looped, 0 });
+                    }
+                    local = time < length ? time : 2.0 * length - time;
+                    break;
+
+                case Mode::OneShot:
+                    if (time >= length || time < 0.0) {
+                        time = std::clamp(time, 0.0, length);
+                        m_stopped.push_back(static_cast<uint32_t>(i));
+                        m_events.push_back({ m_instances[i], Kind::Finished, 0 });
+                    }
+                    local = time;
+                    break;
+                }
+            }
+            m_time[i] = time;
+
+            size_t frame = std::upper_bound(track.ends.begin(), track.ends.end(), local) - track.ends.begin();
+            frame = std::min(frame, track.ends.size() - 1);
+            if (frame != m_frame[i]) {
+                m_frame[i] = static_cast<uint32_t>(frame);
+                m_changed.push_back(static_cast<uint32_t>(i));
+            }
+        }
+
+        for (uint32_t i : m_changed) {
+            const AnimationClip::Frame& frame = m_tracks[m_track[i]].clip->frames[m_frame[i]];
+            store.SetRect(m_instances[i], frame.leftBottom, frame.rightTop);
+            if (frame.tag) {
+                m_events.push_back({ m_instances[i], Kind::Frame, frame.tag });
+            }
+        }
+
+        // back to front, so swapping the last one in doesn't move any still to go
+        std::sort(m_stopped.begin(), m_stopped.end(), std::greater<uint32_t>());
+        for (uint32_t i : m_stopped) {
+            remove(i);
+        }
+
+        if (m_callback && !m_events.empty()) {
+            m_callback(m_events);
+        }
+    }
+
+    void Animator::OnEvents(Callback callback)
+    {
+        m_callback = std::move(callback);
+    }
+
+    const std::vector<AnimationEvent>& Animator::Events() const
+    {
+        return m_events;
+    }
+
+    uint32_t Animator::track(Clip clip)
+    {
+        auto found = m_trackIndex.find(clip.get());
+        if (found != m_trackIndex.end()) {
+            ++m_tracks[found->second].users;
+            return found->second;
+        }
+
+        uint32_t idx;
+        if (m_freeTracks.empty()) {
+            idx = static_cast<uint32_t>(m_tracks.size());
+            m_tracks.emplace_back();
+        }
+        else {
+            idx = m_freeTracks.back();
+            m_freeTracks.pop_back();
+        }
+
+        Track& track = m_tracks[idx];
+        double end = 0.0;
+        track.ends.clear();
+        for (const AnimationClip::Frame& frame : clip->frames) {
+            end += std::max(frame.duration, 0.0);
+            track.ends.push_back(end);
+        }
+        track.length = end;
+        track.users = 1;
+
+        m_trackIndex.emplace(clip.get(), idx);
+        track.clip = std::move(clip);
+        return idx;
+    }
+
+    void Animator::release(uint32_t idx)
+    {
+        Track& track = m_tracks[idx];
+        if (--track.users == 0) {
+            m_trackIndex.erase(track.clip.get());
+            track.clip.reset();
+            m_freeTracks.push_back(idx);
+        }
+    }
+
+    uint32_t Animator::find(InstanceStore::Handle instance) const
+    {
+        if (instance.index >= m_lookup.size()) {
+            return none;
+        }
+        uint32_t idx = m_lookup[instance.index];
+        return idx != none && m_instances[idx] == instance ? idx : none;
+    }
+
+    void Animator::remove(size_t idx)
+    {
+        release(m_track[idx]);
+
+        // a newer instance in the same slot may have taken over the lookup
+        uint32_t& slot = m_lookup[m_instances[idx].index];
+        if (slot == idx) {
+            slot = none;
+        }
+
+        size_t last = m_instances.size() - 1;
+        if (idx != last) {
+            m_instances[idx] = m_instances[last];
+            m_track[idx] = m_track[last];
+            m_time[idx] = m_time[last];
+            m_speed[idx] = m_speed[last];
+            m_frame[idx] = m_frame[last];
+
+            uint32_t& moved = m_lookup[m_instances[idx].index];
+            if (moved == last) {
+                moved = static_cast<uint32_t>(idx);
+            }
+        }
+        m_instances.pop_back();
+        m_track.pop_back();
+        m_time.pop_back();
+        m_speed.pop_back();
+        m_frame.pop_back();
+    }
+
+
+    /*========================================================================*\
+    |  Render queue                                                            |
+    \*========================================================================*/
+
+    namespace
+    {
+        // The layer a depth falls in, as an unsigned int with the same ordering
+        inline uint32_t depthLayer(float depth)
+        {
+            // the int32_t range, as floats that convert back exactly
+            constexpr float lowest = -2147483648.f;
+            constexpr float highest = 2147483520.f;
+
+            float layer = std::floor(depth / settings::renderLayerDepth);
+            layer = layer > lowest ? std::min(layer, highest) : lowest;
+            return static_cast<uint32_t>(static_cast<int32_t>(layer)) ^ 0x80000000u;
+        }
+
+        // key layout: [ inverted layer : 32 | shader : 12 | texture : 20 ]
+        constexpr uint32_t shaderBits = 12;
+        constexpr uint32_t textureBits = 20;
+        constexpr uint64_t batchMask = (uint64_t{ 1 } << (shaderBits + textureBits)) - 1;
+    }
+
+    void RenderQueue::Submit(
+        const Shader& shader,
+        const Texture2D& texture,
+        float depth,
+        vec2f leftBottom,
+        vec2f rightTop,
+        const mat4f& model
+    ) {
+        if (m_culling && !m_frustum.Intersects(Bounds::OfQuad(model))) {
+            ++m_culled;
+            return;
+        }
+
+        uint64_t key = uint64_t{ ~depthLayer(depth) } << (shaderBits + textureBits);
+        key |= uint64_t{ shaderIndex(shader) } << textureBits;
+        key |= textureIndex(texture);
+
+        m_keys.push_back(key);
+        m_models.push_back(model);
+        m_rects.push_back({ leftBottom.x(), leftBottom.y(), rightTop.x(), rightTop.y() });
+    }
+
+    void RenderQueue::SetUniform(const Shader& shader, const char* name, int value)
+    {
+        m_uniforms.push_back({ shader, name, value });
+    }
+
+    void RenderQueue::SetUniform(const Shader& shader, const char* name, float value)
+    {
+        m_uniforms.push_back({ shader, name, value });
+    }
+
+    void RenderQueue::SetUniform(const Shader& shader, const char* name, const vec2f& value)
+    {
+        m_uniforms.push_back({ shader, name, value });
+    }
+
+    void RenderQueue::SetUniform(const Shader& shader, const char* name, const mat4f& value)
+    {
+        m_uniforms.push_back({ shader, name, value });
+    }
+
+    void RenderQueue::Flush()
+    {
+        setUniforms();
+
+        m_stats = Stats{ };
+        m_stats.items = m_keys.size();
+        m_stats.culled = m_culled;
+        m_culled = 0;
+        if (m_keys.empty()) {
+            return;
+        }
+
+        size_t changes = gl::Bound().changes;
+        if (!m_prepared) {
+            prepare();
+        }
+
+        sort();
+
+        const size_t count = m_keys.size();
+        m_sortedModels.resize(count);
+        m_sortedRects.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            m_sortedModels[i] = m_models[m_order[i]];
+            m_sortedRects[i] = m_rects[m_order[i]];
+        }
+
+        // orphan last frame's storage rather than wait on it
+        if (count > m_capacity) {
+            do {
+                m_capacity = m_capacity ? static_cast<size_t>(m_capacity * settings::ssboResizeFactor) : count;
+            } while (count > m_capacity);
+        }
+        m_modelBuffer.Resize(sizeof(mat4f) * m_capacity);
+        m_rectBuffer.Resize(sizeof(vec4f) * m_capacity);
+        m_modelBuffer.Fill(m_sortedModels.data(), sizeof(mat4f) * count);
+        m_rectBuffer.Fill(m_sortedRects.data(), sizeof(vec4f) * count);
+        m_stats.bytesUploaded += (sizeof(mat4f) + sizeof(vec4f)) * count;
+
+        m_vao.Bind();
+        m_modelBuffer.Bind();
+        m_rectBuffer.Bind();
+
+        // one instanced draw per run of matching shader and texture
+        uint32_t currentShader = ~0u;
+        size_t begin = 0;
+        while (begin < count) {
+            const uint64_t batch = m_sortedKeys[begin] & batchMask;
+            size_t end = begin + 1;
+            while (end < count && (m_sortedKeys[end] & batchMask) == batch) {
+                ++end;
+            }
+
+            uint32_t shader = static_cast<uint32_t>(batch >> textureBits);
+            uint32_t texture = static_cast<uint32_t>(batch & ((1u << textureBits) - 1));
+            if (shader != currentShader) {
+                m_shaders[shader].Bind();
+                m_shaders[shader].SetUniform("u_InstanceRects", 1);
+                currentShader = shader;
+            }
+            m_textures[texture].Bind();
+            m_shaders[shader].SetUniform("u_InstanceOffset", static_cast<int>(begin));
+
+            glDrawElementsInstanced(GL_TRIANGLE_STRIP, 4, GL_UNSIGNED_BYTE, (void*)0, static_cast<GLsizei>(end - begin));
+            ++m_stats.drawCalls;
+            begin = end;
+        }
+
+        // leave the shaders as sprites drawing on their own expect them
+        for (Shader& shader : m_shaders) {
+            shader.Bind();
+            shader.SetUniform("u_InstanceRects", 0);
+            shader.SetUniform("u_InstanceOffset", 0);
+        }
+
+        m_stats.stateChanges = gl::Bound().changes - changes;
+
+        m_shaders.clear();
+        m_textures.clear();
+        m_shaderLookup.clear();
+        m_textureLookup.clear();
+        m_keys.clear();
+        m_models.clear();
+        m_rects.clear();
+    }
+
+    void RenderQueue::SetViewProjection(const mat4f& viewProjection)
+    {
+        m_frustum = Frustum{ viewProjection };
+        m_culling = true;
+    }
+
+    void RenderQueue::DisableCulling()
+    {
+        m_culling = false;
+    }
+
+    const RenderQueue::Stats& RenderQueue::LastFrame() const
+    {
+        return m_stats;
+    }
+
+    void RenderQueue::prepare()
+    {
+        // a unit quad; each instance picks its own part of the texture
+        const GLfloat vertices[] = {
+            -0.5f,  -0.5f,  0.f,    0.f,
+            0.5f,   -0.5f,  1.f,    0.f,
+            -0.5f,  0.5f,   0.f,    1.f,
+            0.5f,   0.5f,   1.f,    1.f
+        };
+        m_vbo.Fill(vertices, sizeof(vertices));
+
+        m_vao.Bind();
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat[4]), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(GLfloat[4]), (void*)(sizeof(GLfloat[2])));
+
+        const GLubyte indices[4] = { 0, 1, 2, 3 };
+        m_ebo.Fill(indices, sizeof(indices));
+
+        m_prepared = true;
+    }
+
+    void RenderQueue::setUniforms()
+    {
+        for (Uniform& uniform : m_uniforms) {
+            uniform.shader.Bind();
+            std::visit([&](const auto& value) {
+                uniform.shader.SetUniform(uniform.name.c_str(), value);
+            }, uniform.value);
+        }
+        m_uniforms.clear();
+    }
+
+    void RenderQueue::sort()
+    {
+        // LSD radix sort, a byte at a time, skipping bytes that never vary
+        const size_t count = m_keys.size();
+        m_sortedKeys.assign(m_keys.begin(), m_keys.end());
+        m_order.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            m_order[i] = static_cast<uint32_t>(i);
+        }
+        m_keyScratch.resize(count);
+        m_orderScratch.resize(count);
+
+        for (uint32_t shift = 0; shift < 64; shift += 8) {
+            size_t offsets[256]{ };
+            for (uint64_t key : m_sortedKeys) {
+                ++offsets[(key >> shift) & 0xFF];
+            }
+            if (offsets[(m_sortedKeys[0] >> shift) & 0xFF] == count) {
+                continue;
+            }
+
+            size_t total = 0;
+            for (size_t& offset : offsets) {
+                size_t n = offset;
+                offset = total;
+                total += n;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                size_t dst = offsets[(m_sortedKeys[i] >> shift) & 0xFF]++;
+                m_keyScratch[dst] = m_sortedKeys[i];
+                m_orderScratch[dst] = m_order[i];
+            }
+            m_sortedKeys.swap(m_keyScratch);
+            m_order.swap(m_orderScratch);
+        }
+    }
+
+    uint32_t RenderQueue::shaderIndex(const Shader& shader)
+    {
+        auto [iter, inserted] = m_shaderLookup.try_emplace(shader.Key(), static_cast<uint32_t>(m_shaders.size()));
+        if (inserted) {
+            assert(m_shaders.size() < (size_t{ 1 } << shaderBits));
+            m_shaders.push_back(shader);
+        }
+        return iter->second;
+    }
+
+    uint32_t RenderQueue::textureIndex(const Texture2D& texture)
+    {
+        auto [iter, inserted] = m_textureLookup.try_emplace(texture.Key(), static_cast<uint32_t>(m_textures.size()));
+        if (inserted) {
+            assert(m_textures.size() < (size_t{ 1 } << textureBits));
+            m_textures.push_back(texture);
+        }
+        return iter->second;
+    }
+}
+
+
+#if defined MOPE_ILLUSTRATOR_HEADLESS
+/*============================================================================*\
+|  Headless                                                                    |
+\*============================================================================*/
+
+namespace mope::headless
+{
+    namespace
+    {
+        // Just enough driver state to hand out names and back buffer mappings
+        struct Driver
+        {
+            GLuint nextName{ 1 };
+            uintptr_t nextSync{ 1 };
+            bool persistentMapping{ true };
+            std::unordered_map<GLenum, GLuint> boundBuffers{ };
+            std::unordered_map<GLuint, std::vector<uint8_t>> buffers{ };
+        };
+
+        Driver& driver()
+        {
+            static Driver instance{ };
+            return instance;
+        }
+
+        void record(Proc proc)
+        {
+            ++Recorder().calls[static_cast<size_t>(proc)];
+        }
+
+        std::vector<uint8_t>& boundStorage(GLenum target)
+        {
+            return driver().buffers[driver().boundBuffers[target]];
+        }
+
+        size_t pixelBytes(GLsizei width, GLsizei height, GLenum format, GLenum type)
+        {
+            size_t channels =
+                format == GL_RED ? 1 :
+                format == GL_RG ? 2 :
+                format == GL_RGB ? 3 : 4;
+            size_t size = type == GL_FLOAT ? sizeof(GLfloat) : 1;
+            return static_cast<size_t>(width) * height * channels * size;
+        }
+
+        template <class T>
+        T nothing() { return T(); }
+
+        template <>
+        void nothing<void>() { }
+
+        // By default an entry point is only counted. The stub takes its
+        // signature from the proc's typedef, leaving the parameters unnamed.
+        template <Proc proc, class Fn>
+        struct Null;
+
+        template <Proc proc, class R, class... Args>
+        struct Null<proc, R(Args...)>
+        {
+            static R call(Args...) { record(proc); return nothing<R>(); }
+        };
+
+#define GL_PROC(type, name, ...) \
+        constexpr name##_t* null_##name = &Null<Proc::name, name##_t>::call;
+        GL_PROC_LIST
+#undef GL_PROC
+
+        void genNames(GLsizei n, GLuint* names)
+        {
+            for (GLsizei i = 0; i < n; ++i) {
+                names[i] = driver().nextName++;
+            }
+        }
+
+        void fake_glGenBuffers(GLsizei n, GLuint* buffers)
+        {
+            record(Proc::glGenBuffers);
+            genNames(n, buffers);
+        }
+
+        void fake_glDeleteBuffers(GLsizei n, GLuint* buffers)
+        {
+            record(Proc::glDeleteBuffers);
+            for (GLsizei i = 0; i < n; ++i) {
+                driver().buffers.erase(buffers[i]);
+                // a deleted buffer comes unbound from the plain targets
+                for (auto& [target, bound] : driver().boundBuffers) {
+                    if (bound == buffers[i]) {
+                        bound = 0;
+                    }
+                }
+            }
+        }
+
+        void fake_glGenVertexArrays(GLsizei n, GLuint* arrays)
+        {
+            record(Proc::glGenVertexArrays);
+            genNames(n, arrays);
+        }
+
+        void fake_glGenTextures(GLsizei n, GLuint* textures)
+        {
+            record(Proc::glGenTextures);
+            genNames(n, textures);
+        }
+
+        GLuint fake_glCreateShader(GLenum)
+        {
+            record(Proc::glCreateShader);
+            return driver().nextName++;
+        }
+
+        GLuint fake_glCreateProgram()
+        {
+            record(Proc::glCreateProgram);
+            return driver().nextName++;
+        }
+
+        void fake_glGetShaderiv(GLuint, GLenum, GLint* params)
+        {
+            record(Proc::glGetShaderiv);
+            *params = GL_TRUE;
+        }
+
+        void fake_glGetProgramiv(GLuint, GLenum, GLint* params)
+        {
+            record(Proc::glGetProgramiv);
+            *params = GL_TRUE;
+        }
+
+        void fake_glUseProgram(GLuint)
+        {
+            record(Proc::glUseProgram);
+            ++Recorder().programBinds;
+        }
+
+        void fake_glBindTexture(GLenum, GLuint)
+        {
+            record(Proc::glBindTexture);
+            ++Recorder().textureBinds;
+        }
+
+        void fake_glBindVertexArray(GLuint)
+        {
+            record(Proc::glBindVertexArray);
+            ++Recorder().vertexArrayBinds;
+        }
+
+        void fake_glBindBuffer(GLenum target, GLuint buffer)
+        {
+            record(Proc::glBindBuffer);
+            ++Recorder().bufferBinds;
+            driver().boundBuffers[target] = buffer;
+        }
+
+        void fake_glBindBufferBase(GLenum target, GLuint, GLuint buffer)
+        {
+            record(Proc::glBindBufferBase);
+            ++Recorder().bufferBinds;
+            driver().boundBuffers[target] = buffer;
+        }
+
+        void fake_glBindBufferRange(GLenum target, GLuint, GLuint buffer, GLintptr, GLsizeiptr)
+        {
+            record(Proc::glBindBufferRange);
+            ++Recorder().bufferBinds;
+            driver().boundBuffers[target] = buffer;
+        }
+
+        void fake_glBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum)
+        {
+            record(Proc::glBufferData);
+            if (!driver().boundBuffers[target]) {
+                ++Recorder().unboundWrites;
+                return;
+            }
+            std::vector<uint8_t>& storage = boundStorage(target);
+            storage.assign(size, 0);
+            if (data) {
+                std::memcpy(storage.data(), data, size);
+                Recorder().bufferBytes += size;
+            }
+        }
+
+        void fake_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+        {
+            record(Proc::glBufferSubData);
+            if (!driver().boundBuffers[target]) {
+                ++Recorder().unboundWrites;
+                return;
+            }
+            std::vector<uint8_t>& storage = boundStorage(target);
+            assert(offset + size <= storage.size());
+            std::memcpy(storage.data() + offset, data, size);
+            Recorder().bufferBytes += size;
+        }
+
+        void fake_glBufferStorage(GLenum target, GLsizeiptr size, const void* data, GLbitfield)
+        {
+            record(Proc::glBufferStorage);
+            std::vector<uint8_t>& storage = boundStorage(target);
+            storage.assign(size, 0);
+            if (data) {
+                std::memcpy(storage.data(), data, size);
+                Recorder().bufferBytes += size;
+            }
+        }
+
+        void* fake_glMapBufferRange(GLenum target, GLintptr offset, [[maybe_unused]] GLsizeiptr length, GLbitfield)
+        {
+            record(Proc::glMapBufferRange);
+            std::vector<uint8_t>& storage = boundStorage(target);
+            assert(offset + length <= storage.size());
+            return storage.data() + offset;
+        }
+
+        GLboolean fake_glUnmapBuffer(GLenum)
+        {
+            record(Proc::glUnmapBuffer);
+            return GL_TRUE;
+        }
+
+        GLsync fake_glFenceSync(GLenum, GLbitfield)
+        {
+            record(Proc::glFenceSync);
+            return reinterpret_cast<GLsync>(driver().nextSync++);
+        }
+
+        GLenum fake_glClientWaitSync(GLsync, GLbitfield, GLuint64)
+        {
+            record(Proc::glClientWaitSync);
+            return GL_ALREADY_SIGNALED;
+        }
+
+        void fake_glTexImage2D(GLenum, GLint, GLint, GLsizei width, GLsizei height, GLint, GLenum format, GLenum type, const void* pixels)
+        {
+            record(Proc::glTexImage2D);
+            if (pixels) {
+                Recorder().textureBytes += pixelBytes(width, height, format, type);
+            }
+        }
+
+        void fake_glTexSubImage2D(GLenum, GLint, GLint, GLint, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels)
+        {
+            record(Proc::glTexSubImage2D);
+            // from an unpack buffer, `pixels` is an offset and may well be zero
+            if (pixels || driver().boundBuffers[GL_PIXEL_UNPACK_BUFFER]) {
+                Recorder().textureBytes += pixelBytes(width, height, format, type);
+            }
+        }
+
+        void fake_glDrawElements(GLenum, GLsizei, GLenum, const void*)
+        {
+            record(Proc::glDrawElements);
+            ++Recorder().drawCalls;
+            ++Recorder().instances;
+        }
+
+        void fake_glDrawElementsInstanced(GLenum, GLsizei, GLenum, const void*, GLsizei primcount)
+        {
+            record(Proc::glDrawElementsInstanced);
+            ++Recorder().drawCalls;
+            Recorder().instances += primcount;
+        }
+
+        void fake_glDrawArraysInstanced(GLenum, GLint, GLsizei, GLsizei primcount)
+        {
+            record(Proc::glDrawArraysInstanced);
+            ++Recorder().drawCalls;
+            Recorder().instances += primcount;
+        }
+
+        const char* procNames[] = {
+#define GL_PROC(type, name, ...) #name,
+            GL_PROC_LIST
+#undef GL_PROC
+        };
+    }
+
+    GenericProc GetProcAddress(const char* name)
+    {
+        static const std::unordered_map<std::string_view, GenericProc> procs = [] {
+            std::unordered_map<std::string_view, GenericProc> table;
+#define GL_PROC(type, name, ...) table[#name] = reinterpret_cast<GenericProc>(null_##name);
+            GL_PROC_LIST
+#undef GL_PROC
+
+#define FAKE_PROC(name) table[#name] = reinterpret_cast<GenericProc>(&fake_##name);
+            FAKE_PROC(glGenBuffers)
+            FAKE_PROC(glDeleteBuffers)
+            FAKE_PROC(glGenVertexArrays)
+            FAKE_PROC(glGenTextures)
+            FAKE_PROC(glCreateShader)
+            FAKE_PROC(glCreateProgram)
+            FAKE_PROC(glGetShaderiv)
+            FAKE_PROC(glGetProgramiv)
+            FAKE_PROC(glUseProgram)
+            FAKE_PROC(glBindTexture)
+            FAKE_PROC(glBindVertexArray)
+            FAKE_PROC(glBindBuffer)
+            FAKE_PROC(glBindBufferBase)
+            FAKE_PROC(glBindBufferRange)
+            FAKE_PROC(glBufferData)
+            FAKE_PROC(glBufferSubData)
+            FAKE_PROC(glBufferStorage)
+            FAKE_PROC(glMapBufferRange)
+            FAKE_PROC(glUnmapBuffer)
+            FAKE_PROC(glFenceSync)
+            FAKE_PROC(glClientWaitSync)
+            FAKE_PROC(glTexImage2D)
+            FAKE_PROC(glTexSubImage2D)
+            FAKE_PROC(glDrawElements)
+            FAKE_PROC(glDrawElementsInstanced)
+            FAKE_PROC(glDrawArraysInstanced)
+#undef FAKE_PROC
+            return table;
+        }();
+
+        // pretend not to have buffer storage, so callers take their fallback
+        if (!driver().persistentMapping && std::string_view{ name } == "glBufferStorage") {
+            return nullptr;
+        }
+
+        auto iter = procs.find(name);
+        return iter != procs.end() ? iter->second : nullptr;
+    }
+
+    void SetPersistentMapping(bool enabled)
+    {
+        driver().persistentMapping = enabled;
+    }
+
+    const char* Name(Proc proc)
+    {
+        return procNames[static_cast<size_t>(proc)];
+    }
+
+    Recording& Recorder()
+    {
+        static Recording recording{ };
+        return recording;
+    }
+
+    size_t Recording::Calls(Proc proc) const
+    {
+        return calls[static_cast<size_t>(proc)];
+    }
+
+    void Recording::Reset()
+    {
+        *this = Recording{ };
+    }
+
+    void Recording::WriteJson(std::ostream& out) const
+    {
+        out << "{\"frames\":" << frames
+            << ",\"frameSeconds\":" << frameSeconds
+            << ",\"bufferBytes\":" << bufferBytes
+            << ",\"textureBytes\":" << textureBytes
+            << ",\"programBinds\":" << programBinds
+            << ",\"textureBinds\":" << textureBinds
+            << ",\"bufferBinds\":" << bufferBinds
+            << ",\"vertexArrayBinds\":" << vertexArrayBinds
+            << ",\"drawCalls\":" << drawCalls
+            << ",\"instances\":" << instances
+            << ",\"unboundWrites\":" << unboundWrites
+            << ",\"calls\":{";
+
+        bool first = true;
+        for (size_t i = 0; i < static_cast<size_t>(Proc::count); ++i) {
+            if (calls[i]) {
+                out << (first ? "" : ",") << '"' << procNames[i] << "\":" << calls[i];
+                first = false;
+            }
+        }
+        out << "}}";
+    }
+
+    Renderer::Renderer(Window& window)
+        : m_window{ window }
+        , m_last{ std::chrono::steady_clock::now() }
+    { }
+
+    void Renderer::showFrame()
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = now - m_last;
+        m_last = now;
+
+        Recorder().frameSeconds += elapsed.count();
+        ++Recorder().frames;
+        ++m_window.m_frame;
+    }
+
+    Window::Window(int width, int height, size_t frames, std::vector<InputFrame> script)
+        : m_width{ width }
+        , m_height{ height }
+        , m_frames{ frames }
+        , m_script{ std::move(script) }
+    { }
+
+    std::unique_ptr<BaseRenderer> Window::getRenderer()
+    {
+        return std::make_unique<Renderer>(*this);
+    }
+
+    void Window::setTitle(std::string_view title)
+    {
+        m_title = title;
+    }
+
+    int Window::getWidth() { return m_width; }
+    int Window::getHeight() { return m_height; }
+    int Window::retrieveXDelta() { return current().xDelta; }
+    int Window::retrieveYDelta() { return current().yDelta; }
+    std::bitset<256> Window::getKeyStates() { return current().keys; }
+
+    bool Window::running()
+    {
+        return !m_closed && m_frame < m_frames;
+    }
+
+    void Window::close()
+    {
+        m_closed = true;
+    }
+
+    size_t Window::Frame() const
+    {
+        return m_frame;
+    }
+
+    const std::string& Window::Title() const
+    {
+        return m_title;
+    }
+
+    const InputFrame& Window::current() const
+    {
+        static const InputFrame idle{ };
+        return m_frame < m_script.size() ? m_script[m_frame] : idle;
+    }
+}
+#endif
 
 #endif //MOPE_ILLUSTRATOR_IMPL